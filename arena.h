@@ -0,0 +1,95 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <new>
+#include <string>
+#include <vector>
+
+// Bump allocator for the importer's per-track scratch (paths, tag strings,
+// sort keys). Nothing is freed individually; reset() rewinds to the start and
+// keeps the blocks, so once the first batch has sized it the rest of an
+// import doesn't touch the heap for these. Not thread safe, one per importer.
+class Arena {
+    struct Block {
+        char* data;
+        size_t size;
+    };
+    std::vector<Block> blocks_;
+    size_t block_ = 0; // Block being filled
+    size_t used_ = 0;  // Bytes used in it
+    size_t block_size_;
+    size_t high_water_ = 0;
+
+    size_t in_use() const {
+        size_t total = used_;
+        for(size_t i = 0; i < block_ && i < blocks_.size(); ++i) total += blocks_[i].size;
+        return total;
+    }
+
+public:
+    explicit Arena(size_t block_size = 16 * 1024) : block_size_(block_size) {}
+    ~Arena() {
+        for(Block& block : blocks_) free(block.data);
+    }
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size, size_t align) {
+        while(block_ < blocks_.size()) {
+            size_t start = (used_ + align - 1) & ~(align - 1);
+            if(start + size <= blocks_[block_].size) {
+                used_ = start + size;
+                return blocks_[block_].data + start;
+            }
+            block_ += 1;
+            used_ = 0;
+        }
+        // Oversized requests get a block of their own
+        size_t want = size + align > block_size_ ? size + align : block_size_;
+        char* data = static_cast<char*>(malloc(want));
+        if(data == nullptr) throw std::bad_alloc();
+        blocks_.push_back({data, want});
+        block_ = blocks_.size() - 1;
+        used_ = 0;
+        return allocate(size, align);
+    }
+
+    // Everything handed out so far is dead
+    void reset() {
+        size_t total = in_use();
+        if(total > high_water_) high_water_ = total;
+        block_ = 0;
+        used_ = 0;
+    }
+
+    // Most bytes in use between two resets
+    size_t high_water() const { return high_water_; }
+    size_t capacity() const {
+        size_t total = 0;
+        for(const Block& block : blocks_) total += block.size;
+        return total;
+    }
+};
+
+// std allocator on top of an Arena, deallocate is a no-op
+template<typename T>
+struct ArenaAllocator {
+    using value_type = T;
+    Arena* arena;
+
+    explicit ArenaAllocator(Arena& a) : arena(&a) {}
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T*, size_t) {}
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+    template<typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+};
+
+using ArenaString = std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
@@ -0,0 +1,37 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// Printable ASCII prebaked at build time (tools/atlasgen.cpp), so fixed labels
+// draw without touching the runtime font
+
+struct AtlasGlyph {
+    bool present;
+    uint8_t w, h, baseline, adv_x;
+    uint32_t offset; // into ATLAS_PIXELS, rows are w bytes
+};
+
+#include "glyph_atlas_data.h"
+
+// Baked glyph, NULL if that code/size isn't in the atlas
+inline const AtlasGlyph* atlas_glyph(uint32_t size, uint32_t code) {
+    if(!ATLAS_BAKED || code < ATLAS_FIRST || code > ATLAS_LAST) return nullptr;
+    for(size_t i = 0; i < sizeof(ATLAS_SIZES) / sizeof(ATLAS_SIZES[0]); ++i) {
+        if(ATLAS_SIZES[i] != size) continue;
+        const AtlasGlyph* glyph = &ATLAS_GLYPHS[i][code - ATLAS_FIRST];
+        return glyph->present ? glyph : nullptr;
+    }
+    return nullptr;
+}
+
+// Whether the whole string can be drawn from the atlas
+inline bool atlas_covers(uint32_t size, const std::string& text) {
+    for(unsigned char c : text)
+        if(atlas_glyph(size, c) == nullptr) return false;
+    return true;
+}
+
+inline const uint8_t* atlas_pixels(const AtlasGlyph& glyph) {
+    return ATLAS_PIXELS + glyph.offset;
+}
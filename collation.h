@@ -0,0 +1,84 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+
+#include <sqlite3.h>
+#include "sortkey.h"
+
+// Binary sort key for a name: comparing two keys with memcmp gives the order
+// people expect from a music library. The primary part is the romanized text
+// (sortkey.h) with ASCII case folded and digit runs compared by value
+// ("Vol. 2" before "Vol. 10"); the original bytes follow after a 0 byte so
+// names differing only in case/accents/script still order consistently.
+inline std::string collation_key(const char* text, size_t size) {
+    // Stored names carry their NUL terminator
+    while(size > 0 && text[size - 1] == '\0') --size;
+    std::string original(text, size);
+    std::string roman = romanize(original);
+
+    std::string key;
+    key.reserve(roman.size() + size + 4);
+    for(size_t i = 0; i < roman.size();) {
+        unsigned char c = roman[i];
+        if(c >= '0' && c <= '9') {
+            // '0', digit count, digits without leading zeros
+            size_t end = i;
+            while(end < roman.size() && roman[end] >= '0' && roman[end] <= '9') ++end;
+            size_t first = i;
+            while(first + 1 < end && roman[first] == '0') ++first;
+            key += '0';
+            key += (char)std::min<size_t>(end - first, 0xff);
+            key.append(roman, first, end - first);
+            i = end;
+            continue;
+        }
+        key += (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : (char)c;
+        ++i;
+    }
+    key += '\0';
+    key += original;
+    return key;
+}
+
+// Keys are worked out once per distinct name and reused by every comparison
+class CollationKeys {
+    // Plenty for a library's albums and artists, bounds memory on odd input
+    static constexpr size_t MAX_KEYS = 1 << 16;
+    std::unordered_map<std::string, std::string> keys_;
+
+public:
+    const std::string& key(const char* text, size_t size) {
+        std::string name(text, size);
+        auto it = keys_.find(name);
+        if(it != keys_.end()) return it->second;
+        return keys_.emplace(std::move(name), collation_key(text, size)).first->second;
+    }
+
+    static int compare(void* self, int a_size, const void* a, int b_size, const void* b) {
+        auto& keys = *static_cast<CollationKeys*>(self);
+        // Never between the two lookups, the first key must stay valid
+        if(keys.keys_.size() >= MAX_KEYS) keys.keys_.clear();
+        const std::string& a_key = keys.key((const char*)a, a_size);
+        const std::string& b_key = keys.key((const char*)b, b_size);
+        int order = memcmp(a_key.data(), b_key.data(), std::min(a_key.size(), b_key.size()));
+        if(order != 0) return order;
+        return a_key.size() < b_key.size() ? -1 : a_key.size() > b_key.size() ? 1 : 0;
+    }
+};
+
+// ... ORDER BY album COLLATE TAGKEY. Only used in queries, never stored in the
+// schema, so the firmware doesn't need to know it.
+inline bool register_tagkey_collation(sqlite3* db) {
+    auto* keys = new CollationKeys();
+    int rc = sqlite3_create_collation_v2(db, "TAGKEY", SQLITE_UTF8, keys, CollationKeys::compare,
+            [](void* p){ delete static_cast<CollationKeys*>(p); });
+    if(rc != SQLITE_OK) {
+        delete keys;
+        return false;
+    }
+    return true;
+}
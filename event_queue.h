@@ -0,0 +1,59 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+#include <atomic>
+
+// Bounded lock-free multi-producer/single-consumer queue (Vyukov's bounded
+// queue with a plain consumer index). Every pushed item is popped exactly once.
+template<typename T, size_t N>
+class MpscQueue {
+    static_assert((N & (N - 1)) == 0, "size must be a power of two");
+
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+    std::array<Cell, N> cells_;
+    std::atomic<size_t> enqueue_pos_{0};
+    size_t dequeue_pos_ = 0; // consumer only
+
+public:
+    MpscQueue() {
+        for(size_t i = 0; i < N; ++i)
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    // Any thread. False if the queue is full.
+    bool push(const T& item) {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        for(;;) {
+            Cell& cell = cells_[pos & (N - 1)];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if(diff == 0) {
+                // Slot is free for this position, claim it
+                if(enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.data = item;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if(diff < 0) {
+                return false; // Consumer hasn't freed this slot yet
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer thread only
+    bool pop(T& item) {
+        Cell& cell = cells_[dequeue_pos_ & (N - 1)];
+        size_t seq = cell.sequence.load(std::memory_order_acquire);
+        if((intptr_t)seq - (intptr_t)(dequeue_pos_ + 1) < 0) return false;
+        item = cell.data;
+        cell.sequence.store(dequeue_pos_ + N, std::memory_order_release);
+        ++dequeue_pos_;
+        return true;
+    }
+};
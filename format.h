@@ -0,0 +1,127 @@
+#pragma once
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+// Identifies audio files by their first bytes instead of their name, so a
+// misnamed file gets the right parser and format ID and anything that isn't
+// audio is skipped before TagLib opens it. No allocation. Formats without a
+// magic here (AIFF, APE, WavPack, WMA...) are left to TagLib's choice by
+// extension, as Other.
+
+enum class AudioFormat : uint8_t { Unknown, Flac, Mpeg, OggVorbis, OggOpus, OggFlac, Wav, Mp4, Other };
+
+struct FormatInfo {
+    AudioFormat format;
+    int format_id; // What the firmware stores in MEDIA_TABLE
+};
+
+// Not sure what official registration of codes is
+// https://www.recordingblogs.com/wiki/format-chunk-of-a-wave-file
+constexpr FormatInfo FORMATS[] = {
+    {AudioFormat::Unknown, 0},
+    {AudioFormat::Flac, 61686},
+    {AudioFormat::Mpeg, 85},
+    {AudioFormat::OggVorbis, 22127},
+    {AudioFormat::OggOpus, 2373},
+    {AudioFormat::OggFlac, 61686},
+    {AudioFormat::Wav, 1},
+    {AudioFormat::Mp4, 278},
+    {AudioFormat::Other, 0},
+};
+
+constexpr int format_id(AudioFormat format) {
+    return FORMATS[(size_t)format].format_id;
+}
+
+// Fixed bytes at offset, optionally a second run further in
+struct Magic {
+    uint8_t offset;
+    const char* bytes;
+    uint8_t offset2;
+    const char* bytes2;
+    AudioFormat format;
+};
+
+constexpr Magic MAGICS[] = {
+    {0, "fLaC", 0, nullptr, AudioFormat::Flac},
+    {0, "OggS", 28, "OpusHead", AudioFormat::OggOpus},
+    {0, "OggS", 29, "vorbis", AudioFormat::OggVorbis},
+    {0, "OggS", 29, "FLAC", AudioFormat::OggFlac},
+    {0, "RIFF", 8, "WAVE", AudioFormat::Wav},
+    {4, "ftyp", 0, nullptr, AudioFormat::Mp4},
+};
+
+// Enough for the furthest magic above
+constexpr size_t MAGIC_BYTES = 40;
+
+constexpr size_t const_strlen(const char* s) {
+    return *s ? 1 + const_strlen(s + 1) : 0;
+}
+
+constexpr bool magic_fits(size_t i = 0) {
+    return i == sizeof(MAGICS) / sizeof(MAGICS[0]) ||
+        (MAGICS[i].offset + const_strlen(MAGICS[i].bytes) <= MAGIC_BYTES &&
+         (MAGICS[i].bytes2 == nullptr || MAGICS[i].offset2 + const_strlen(MAGICS[i].bytes2) <= MAGIC_BYTES) &&
+         magic_fits(i + 1));
+}
+static_assert(magic_fits(), "MAGIC_BYTES too small for a magic");
+
+// Format of a file header, Unknown if it isn't audio we handle
+inline AudioFormat detect_format(const uint8_t* head, size_t size) {
+    for(const Magic& magic : MAGICS) {
+        size_t len = const_strlen(magic.bytes);
+        if(magic.offset + len > size || memcmp(head + magic.offset, magic.bytes, len) != 0) continue;
+        if(magic.bytes2 != nullptr) {
+            size_t len2 = const_strlen(magic.bytes2);
+            if(magic.offset2 + len2 > size || memcmp(head + magic.offset2, magic.bytes2, len2) != 0) continue;
+        }
+        return magic.format;
+    }
+    // MPEG audio frame sync: 11 set bits, layer bits not 00 (that's AAC ADTS)
+    if(size >= 2 && head[0] == 0xff && (head[1] & 0xe0) == 0xe0 && (head[1] & 0x06) != 0)
+        return AudioFormat::Mpeg;
+    return AudioFormat::Unknown;
+}
+
+// Reads the start of the file, skipping ID3v2 tags (MP3s and some FLACs have
+// them in front) to see what follows
+inline AudioFormat detect_file_format(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) return AudioFormat::Unknown;
+    uint8_t head[MAGIC_BYTES];
+    off_t offset = 0;
+    AudioFormat format = AudioFormat::Unknown;
+    // A few stacked tags at most
+    for(int tags = 0; tags < 4; ++tags) {
+        ssize_t got = pread(fd, head, sizeof(head), offset);
+        if(got <= 0) break;
+        if(got >= 10 && memcmp(head, "ID3", 3) == 0) {
+            // Syncsafe size, plus header and optional footer
+            off_t size = ((off_t)(head[6] & 0x7f) << 21) | ((head[7] & 0x7f) << 14) | ((head[8] & 0x7f) << 7) | (head[9] & 0x7f);
+            offset += 10 + size + ((head[5] & 0x10) ? 10 : 0);
+            // A tag in front of anything unrecognizable is still most likely MP3
+            format = AudioFormat::Mpeg;
+            continue;
+        }
+        AudioFormat found = detect_format(head, got);
+        if(found != AudioFormat::Unknown) format = found;
+        break;
+    }
+    close(fd);
+    return format;
+}
+
+// Extensions of the formats detect_format confirms. A file named like one
+// whose bytes say otherwise isn't audio.
+inline bool audio_extension(const char* name) {
+    constexpr const char* EXTENSIONS[] = {
+        "mp3", "flac", "ogg", "oga", "opus", "wav", "m4a", "mp4"};
+    const char* dot = strrchr(name, '.');
+    if(dot == nullptr) return false;
+    for(const char* ext : EXTENSIONS)
+        if(strcasecmp(dot + 1, ext) == 0) return true;
+    return false;
+}
@@ -0,0 +1,4 @@
+#!/bin/sh
+wget https://www.unicode.org/Public/UCD/latest/ucd/Unihan.zip
+unzip -o Unihan.zip Unihan_Readings.txt
+rm Unihan.zip
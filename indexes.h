@@ -0,0 +1,67 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+#include "schema.h"
+
+// Indexes that only exist while tagadder is importing. The importer looks up
+// MEDIA_TABLE by path and the album/artist tables by name for every track;
+// without these each lookup is a table scan. They're dropped again before the
+// firmware gets the db back so its schema stays what it expects, and any left
+// by a crash are dropped at the next start.
+class SessionIndexes {
+    static constexpr const char* PREFIX = "tagadder_session_";
+    sqlite3* db_;
+    bool active_ = false;
+
+    bool exec(const std::string& sql) {
+        char* errmsg = NULL;
+        sqlite3_exec(db_, sql.c_str(), NULL, NULL, &errmsg);
+        if(errmsg != NULL) {
+            std::cout << "Session index - " << errmsg << "\n";
+            sqlite3_free(errmsg);
+            return false;
+        }
+        return true;
+    }
+
+public:
+    explicit SessionIndexes(sqlite3* db) : db_(db) {}
+
+    // Idempotent, also brings back the album ones after the album tables were
+    // recreated (SQL_FIX_ALBUM_SORT)
+    bool create() {
+        std::string path = column_name(db_, "MEDIA_TABLE", 1);
+        std::string sql;
+        if(!path.empty())
+            sql += std::string("CREATE INDEX IF NOT EXISTS ") + PREFIX + "media_path ON MEDIA_TABLE(" + quote_name(path) + ");";
+        // Covering: the checks only read cn
+        for(const char* table : {"ALBUM_TABLE", "ALBUM2_TABLE"})
+            sql += std::string("CREATE INDEX IF NOT EXISTS ") + PREFIX + table + " ON " + table + "(album, cn);";
+        for(const char* table : {"ARTIST_TABLE", "ARTIST2_TABLE"})
+            sql += std::string("CREATE INDEX IF NOT EXISTS ") + PREFIX + table + " ON " + table + "(artist, cn);";
+        active_ = exec(sql);
+        return active_;
+    }
+
+    // Drops every session index, including ones from an earlier run
+    void drop() {
+        std::vector<std::string> names;
+        const char* query = "SELECT name FROM sqlite_master WHERE type = 'index' AND name LIKE 'tagadder\\_session\\_%' ESCAPE '\\';";
+        sqlite3_stmt* stmt;
+        if(sqlite3_prepare_v2(db_, query, -1, &stmt, NULL) == SQLITE_OK) {
+            while(sqlite3_step(stmt) == SQLITE_ROW)
+                names.emplace_back((const char*)sqlite3_column_text(stmt, 0));
+            sqlite3_finalize(stmt);
+        }
+        std::string sql;
+        for(auto& name : names) sql += "DROP INDEX IF EXISTS " + quote_name(name) + ";";
+        if(!sql.empty() && exec(sql))
+            std::cout << "Dropped " << names.size() << " session indexes\n";
+        active_ = false;
+    }
+
+    bool active() const { return active_; }
+};
@@ -0,0 +1,190 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <linux/input.h>
+
+// Turns raw evdev frames from the touchscreen into taps, long presses and swipes
+
+inline int64_t now_us(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+struct Gesture {
+    enum class Kind : uint8_t { Tap, LongPress, Swipe };
+
+    Kind kind = Kind::Tap;
+    // Where the contact went down
+    int32_t x = 0, y = 0;
+    // Movement from there to where it was lifted (swipes)
+    int32_t dx = 0, dy = 0;
+    // Kernel timestamp of the frame that completed the gesture, us
+    int64_t time_us = 0;
+};
+
+class GestureRecognizer {
+    // Anything that moves further than this is a swipe
+    static constexpr int32_t SWIPE_DISTANCE = 40;
+    // Held in place this long is a long press
+    static constexpr int64_t LONG_PRESS_US = 600000;
+    // Without explicit up events, a contact that stops reporting is lifted
+    static constexpr int64_t IDLE_RELEASE_US = 120000;
+
+    // Frame being assembled until SYN_REPORT
+    int32_t frame_x_ = -1, frame_y_ = -1;
+    int frame_touch_ = -1; // -1 unchanged, 0 up, 1 down
+    bool frame_has_contact_ = false;
+
+    // Current contact
+    bool down_ = false;
+    bool fired_ = false; // long press already reported for this contact
+    int32_t last_x_ = 0, last_y_ = 0;
+    int32_t start_x_ = 0, start_y_ = 0;
+    int64_t start_us_ = 0;
+    int64_t last_frame_us_ = 0;
+    bool position_known_ = false;
+    // Device reports BTN_TOUCH, tracking ids or type A contact frames
+    bool reports_release_ = false;
+
+    static int64_t event_us(const input_event& ev) {
+        return (int64_t)ev.time.tv_sec * 1000000 + ev.time.tv_usec;
+    }
+
+    bool moved() const {
+        return abs(last_x_ - start_x_) > SWIPE_DISTANCE || abs(last_y_ - start_y_) > SWIPE_DISTANCE;
+    }
+
+    void fill(Gesture& out, Gesture::Kind kind, int64_t time_us) const {
+        out = Gesture{};
+        out.kind = kind;
+        out.x = start_x_;
+        out.y = start_y_;
+        out.dx = last_x_ - start_x_;
+        out.dy = last_y_ - start_y_;
+        out.time_us = time_us;
+    }
+
+    bool release(int64_t time_us, Gesture& out) {
+        down_ = false;
+        if(fired_ || !position_known_) return false;
+        if(moved())
+            fill(out, Gesture::Kind::Swipe, time_us);
+        else if(time_us - start_us_ >= LONG_PRESS_US)
+            fill(out, Gesture::Kind::LongPress, time_us);
+        else
+            fill(out, Gesture::Kind::Tap, time_us);
+        return true;
+    }
+
+    bool end_frame(int64_t time_us, Gesture& out) {
+        last_frame_us_ = time_us;
+        if(frame_x_ >= 0) last_x_ = frame_x_;
+        if(frame_y_ >= 0) last_y_ = frame_y_;
+        if(frame_x_ >= 0 || frame_y_ >= 0) position_known_ = true;
+
+        // Devices without BTN_TOUCH/tracking ids only report positions while touched
+        bool touching = frame_touch_ == 1 || (frame_touch_ == -1 && (down_ || frame_has_contact_));
+        frame_x_ = frame_y_ = -1;
+        frame_touch_ = -1;
+        frame_has_contact_ = false;
+
+        if(touching && !down_) {
+            down_ = true;
+            fired_ = false;
+            start_x_ = last_x_;
+            start_y_ = last_y_;
+            start_us_ = time_us;
+            return false;
+        }
+        if(!touching && down_)
+            return release(time_us, out);
+        return false;
+    }
+
+public:
+    // Feed one event, true when it completed a gesture
+    bool feed(const input_event& ev, Gesture& out) {
+        if(ev.type == EV_ABS) {
+            if(ev.code == ABS_MT_POSITION_X || ev.code == ABS_X) {
+                frame_x_ = ev.value;
+                frame_has_contact_ = true;
+            } else if(ev.code == ABS_MT_POSITION_Y || ev.code == ABS_Y) {
+                frame_y_ = ev.value;
+                frame_has_contact_ = true;
+            } else if(ev.code == ABS_MT_TRACKING_ID) {
+                frame_touch_ = ev.value >= 0;
+                reports_release_ = true;
+            }
+        } else if(ev.type == EV_KEY && ev.code == BTN_TOUCH) {
+            frame_touch_ = ev.value != 0;
+            reports_release_ = true;
+        } else if(ev.type == EV_SYN && ev.code == SYN_MT_REPORT) {
+            // Type A protocol: an empty contact report means lifted
+            if(!frame_has_contact_) frame_touch_ = 0;
+            reports_release_ = true;
+        } else if(ev.type == EV_SYN && ev.code == SYN_REPORT) {
+            return end_frame(event_us(ev), out);
+        }
+        return false;
+    }
+
+    // How long the reader may block before tick() is due, ms
+    int timeout_ms(int64_t now, int idle_ms) const {
+        if(!down_) return idle_ms;
+        int64_t due = reports_release_ ? INT64_MAX : last_frame_us_ + IDLE_RELEASE_US;
+        if(!fired_) due = std::min(due, start_us_ + LONG_PRESS_US);
+        if(due == INT64_MAX) return idle_ms;
+        int64_t left = (due - now) / 1000 + 1;
+        return left < 0 ? 0 : (left < idle_ms ? (int)left : idle_ms);
+    }
+
+    // Call when no events arrived for a while; reports a long press while
+    // still held, or the end of a contact on devices without up events
+    bool tick(int64_t now, Gesture& out) {
+        if(!down_) return false;
+        if(!reports_release_ && now - last_frame_us_ >= IDLE_RELEASE_US)
+            return release(last_frame_us_, out);
+        if(fired_ || moved() || now - start_us_ < LONG_PRESS_US) return false;
+        fired_ = true;
+        fill(out, Gesture::Kind::LongPress, start_us_ + LONG_PRESS_US);
+        return true;
+    }
+};
+
+// Kernel timestamp to handled latency, reported as a running summary
+struct LatencyStats {
+    uint64_t count = 0;
+    int64_t total_us = 0, max_us = 0;
+
+    void add(int64_t us) {
+        if(us < 0) us = 0;
+        count += 1;
+        total_us += us;
+        if(us > max_us) max_us = us;
+    }
+
+    int64_t average_us() const { return count ? total_us / (int64_t)count : 0; }
+};
+
+// Drops a tap that lands right after and right next to the previous one
+// (contact bounce), everything else passes
+class Debouncer {
+    static constexpr int64_t WINDOW_US = 200000;
+    static constexpr int32_t RADIUS = 30;
+    bool have_last_ = false;
+    Gesture last_{};
+
+public:
+    bool accept(const Gesture& g) {
+        bool bounce = have_last_ && g.kind == Gesture::Kind::Tap && last_.kind == Gesture::Kind::Tap &&
+            g.time_us - last_.time_us < WINDOW_US &&
+            abs(g.x - last_.x) <= RADIUS && abs(g.y - last_.y) <= RADIUS;
+        if(bounce) return false;
+        have_last_ = true;
+        last_ = g;
+        return true;
+    }
+};
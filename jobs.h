@@ -0,0 +1,215 @@
+#pragma once
+#include <stdint.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Directory imports waiting for, or running on, the background worker
+struct ImportJob {
+    enum class Kind : uint8_t { Import, Reconcile, Rebuild, Refine };
+    enum class Status : uint8_t { Queued, Running, Done, Cancelled, Failed };
+
+    uint32_t id = 0;
+    Kind kind = Kind::Import;
+    std::string directory{}; // What's shown for a reconcile
+    Status status = Status::Queued;
+    bool cancel = false; // Asked to stop, honoured at the next track
+    uint32_t files_done = 0;
+    uint32_t files_total = 0;
+    std::chrono::steady_clock::time_point started{}, finished{};
+};
+
+inline const char* job_status_name(ImportJob::Status status) {
+    switch(status) {
+        case ImportJob::Status::Queued: return "queued";
+        case ImportJob::Status::Running: return "running";
+        case ImportJob::Status::Done: return "done";
+        case ImportJob::Status::Cancelled: return "cancelled";
+        case ImportJob::Status::Failed: return "failed";
+    }
+    return "?";
+}
+
+// FIFO of import jobs shared between the UI (adds, cancels, shows status) and
+// one worker (takes jobs and reports progress at track boundaries)
+class ImportQueue {
+    mutable std::mutex mutex_;
+    std::condition_variable condition_;
+    std::deque<ImportJob> jobs_; // Finished jobs stay for the status screen
+    uint32_t next_id_ = 1;
+    bool shutdown_ = false;
+
+    ImportJob* find(uint32_t id) {
+        for(auto& job : jobs_) if(job.id == id) return &job;
+        return nullptr;
+    }
+
+public:
+    // Finished jobs kept around for display
+    static constexpr size_t MAX_FINISHED = 8;
+
+    // Returns the job id, or 0 if the directory is already queued or running
+    uint32_t enqueue(const std::string& directory, ImportJob::Kind kind = ImportJob::Kind::Import) {
+        uint32_t id;
+        {
+            std::lock_guard<decltype(mutex_)> lock(mutex_);
+            for(auto& job : jobs_) {
+                if(job.kind == kind && job.directory == directory &&
+                        (job.status == ImportJob::Status::Queued || job.status == ImportJob::Status::Running))
+                    return 0;
+            }
+            ImportJob job;
+            job.id = id = next_id_++;
+            job.kind = kind;
+            job.directory = directory;
+            jobs_.push_back(std::move(job));
+        }
+        condition_.notify_all();
+        return id;
+    }
+
+    // Queued jobs are dropped right away, a running one stops after its
+    // current track. False if it already finished.
+    bool cancel(uint32_t id) {
+        std::lock_guard<decltype(mutex_)> lock(mutex_);
+        ImportJob* job = find(id);
+        if(job == nullptr) return false;
+        if(job->status == ImportJob::Status::Queued) {
+            job->status = ImportJob::Status::Cancelled;
+            return true;
+        }
+        if(job->status != ImportJob::Status::Running) return false;
+        job->cancel = true;
+        return true;
+    }
+
+    // Stop handing out jobs and cancel the running one
+    void shutdown() {
+        {
+            std::lock_guard<decltype(mutex_)> lock(mutex_);
+            shutdown_ = true;
+            for(auto& job : jobs_) job.cancel = true;
+        }
+        condition_.notify_all();
+    }
+
+    // True once shutdown was asked for
+    bool stopping() const {
+        std::lock_guard<decltype(mutex_)> lock(mutex_);
+        return shutdown_;
+    }
+
+    //// Worker
+
+    // Blocks for the next queued job that accept(job) takes (workers split
+    // jobs by device) and marks it running. False on shutdown.
+    template<typename Accept>
+    bool take(ImportJob& out, Accept&& accept) {
+        std::unique_lock<decltype(mutex_)> lock(mutex_);
+        for(;;) {
+            if(shutdown_) return false;
+            for(auto& job : jobs_) {
+                if(job.status != ImportJob::Status::Queued || !accept(job)) continue;
+                job.status = ImportJob::Status::Running;
+                job.started = std::chrono::steady_clock::now();
+                out = job;
+                return true;
+            }
+            condition_.wait(lock);
+        }
+    }
+
+    bool take(ImportJob& out) {
+        return take(out, [](const ImportJob&){ return true; });
+    }
+
+    // Progress at a track boundary, false if the job should stop now
+    bool progress(uint32_t id, uint32_t files_done, uint32_t files_total) {
+        std::lock_guard<decltype(mutex_)> lock(mutex_);
+        ImportJob* job = find(id);
+        if(job == nullptr) return false;
+        job->files_done = files_done;
+        job->files_total = files_total;
+        return !job->cancel;
+    }
+
+    void finish(uint32_t id, bool ok) {
+        std::lock_guard<decltype(mutex_)> lock(mutex_);
+        ImportJob* job = find(id);
+        if(job == nullptr) return;
+        job->status = !ok ? ImportJob::Status::Failed
+            : job->cancel ? ImportJob::Status::Cancelled : ImportJob::Status::Done;
+        job->finished = std::chrono::steady_clock::now();
+
+        // Forget the oldest finished jobs
+        size_t finished = 0;
+        for(auto& j : jobs_)
+            if(j.status != ImportJob::Status::Queued && j.status != ImportJob::Status::Running) ++finished;
+        for(auto it = jobs_.begin(); it != jobs_.end() && finished > MAX_FINISHED;) {
+            if(it->status != ImportJob::Status::Queued && it->status != ImportJob::Status::Running) {
+                it = jobs_.erase(it);
+                --finished;
+            } else
+                ++it;
+        }
+    }
+
+    //// Anyone
+
+    std::vector<ImportJob> snapshot() const {
+        std::lock_guard<decltype(mutex_)> lock(mutex_);
+        return std::vector<ImportJob>(jobs_.begin(), jobs_.end());
+    }
+
+    bool busy() const {
+        std::lock_guard<decltype(mutex_)> lock(mutex_);
+        for(auto& job : jobs_)
+            if(job.status == ImportJob::Status::Queued || job.status == ImportJob::Status::Running) return true;
+        return false;
+    }
+
+    // Tracks per second over the time spent importing, all imports together.
+    // Imports on different cards overlap, so the time is that of the union
+    // of their running intervals. Other kinds count rows, not tracks.
+    static double throughput(const std::vector<ImportJob>& jobs) {
+        typedef std::chrono::steady_clock::time_point Time;
+        uint64_t files = 0;
+        std::vector<std::pair<Time, Time>> spans;
+        auto now = std::chrono::steady_clock::now();
+        for(auto& job : jobs) {
+            if(job.kind != ImportJob::Kind::Import || job.status == ImportJob::Status::Queued) continue;
+            if(job.started == Time{}) continue; // Cancelled while queued
+            files += job.files_done;
+            spans.emplace_back(job.started, job.status == ImportJob::Status::Running ? now : job.finished);
+        }
+        std::sort(spans.begin(), spans.end());
+        double seconds = 0;
+        for(size_t i = 0; i < spans.size();) {
+            Time start = spans[i].first, end = spans[i].second;
+            for(++i; i < spans.size() && spans[i].first <= end; ++i) end = std::max(end, spans[i].second);
+            seconds += std::chrono::duration<double>(end - start).count();
+        }
+        return seconds > 0 ? files / seconds : 0.;
+    }
+};
+
+// Make the calling thread yield CPU and card access to the UI and the player
+inline void lower_thread_priority() {
+    pid_t tid = syscall(SYS_gettid);
+    // Per thread on Linux
+    setpriority(PRIO_PROCESS, tid, 10);
+#ifdef SYS_ioprio_set
+    // Best effort class, lowest level (glibc has no wrapper)
+    const int IOPRIO_WHO_PROCESS = 1, IOPRIO_CLASS_BE = 2, IOPRIO_CLASS_SHIFT = 13;
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | 7);
+#endif
+}
@@ -0,0 +1,187 @@
+#pragma once
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Where each directory import got to, kept on disk so an import killed half
+// way (battery, crash) resumes instead of duplicating or skipping tracks.
+//
+// Files are imported in sorted order in batches, one transaction each. Before
+// a batch the journal records the ids it is about to use; after the commit it
+// records the last path written. If the process dies in between, whether the
+// batch made it is decided by looking for its ids in the db.
+struct JournalEntry {
+    std::string directory{};
+    uint32_t files_done = 0;   // Files processed so far, skipped ones included
+    std::string last_path{};   // Last committed file, empty before the first batch
+    // Batch that was being written, ids [batch_first, batch_last]
+    bool batch_open = false;
+    int batch_first = 0, batch_last = 0;
+    std::string batch_end{};   // Last file of that batch
+    uint32_t batch_files = 0;  // Files it covers, what files_done grows by
+};
+
+class ImportJournal {
+    static constexpr const char* HEADER = "tagadder-journal 1";
+
+    std::string path_;
+    std::mutex mutex_;
+    std::vector<JournalEntry> entries_;
+
+    JournalEntry* find(const std::string& directory) {
+        for(auto& entry : entries_) if(entry.directory == directory) return &entry;
+        return nullptr;
+    }
+
+    // Write a temp file, fsync, rename over the old one, fsync the directory:
+    // after a crash either the old or the new journal is there, complete
+    bool save() {
+        std::ostringstream out;
+        out << HEADER << "\n";
+        for(auto& e : entries_) {
+            // Tab separated, FAT names can't contain tabs or newlines
+            out << e.files_done << '\t' << e.batch_open << '\t' << e.batch_first << '\t' << e.batch_last << '\t'
+                << e.directory << '\t' << e.last_path << '\t' << e.batch_end << '\t' << e.batch_files << "\n";
+        }
+        std::string data = out.str();
+
+        std::string tmp = path_ + ".tmp";
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(fd < 0) {
+            std::cout << "Can't write " << tmp << " - " << strerror(errno) << "\n";
+            return false;
+        }
+        size_t written = 0;
+        while(written < data.size()) {
+            ssize_t n = write(fd, data.data() + written, data.size() - written);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) break;
+            written += n;
+        }
+        bool ok = written == data.size() && fsync(fd) == 0;
+        close(fd);
+        if(!ok || rename(tmp.c_str(), path_.c_str()) != 0) {
+            std::cout << "Can't update journal " << path_ << " - " << strerror(errno) << "\n";
+            unlink(tmp.c_str());
+            return false;
+        }
+
+        std::string dir = path_.substr(0, path_.find_last_of('/') + 1);
+        int dir_fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if(dir_fd >= 0) {
+            fsync(dir_fd);
+            close(dir_fd);
+        }
+        return true;
+    }
+
+public:
+    explicit ImportJournal(std::string path) : path_(std::move(path)) {}
+
+    // Read what a previous run left, a missing journal is an empty one
+    void load() {
+        std::lock_guard<decltype(mutex_)> lock(mutex_);
+        entries_.clear();
+        std::ifstream file(path_);
+        std::string line;
+        if(!std::getline(file, line)) return;
+        if(line != HEADER) {
+            std::cout << "Ignoring journal " << path_ << " with unknown format\n";
+            return;
+        }
+        while(std::getline(file, line)) {
+            std::vector<std::string> fields;
+            size_t start = 0, tab;
+            while((tab = line.find('\t', start)) != std::string::npos) {
+                fields.push_back(line.substr(start, tab - start));
+                start = tab + 1;
+            }
+            fields.push_back(line.substr(start));
+            // batch_files came later, journals without it have 7
+            if(fields.size() != 7 && fields.size() != 8) continue;
+
+            JournalEntry e;
+            e.files_done = strtoul(fields[0].c_str(), NULL, 10);
+            e.batch_open = fields[1] == "1";
+            e.batch_first = atoi(fields[2].c_str());
+            e.batch_last = atoi(fields[3].c_str());
+            e.directory = fields[4];
+            e.last_path = fields[5];
+            e.batch_end = fields[6];
+            e.batch_files = fields.size() > 7 ? strtoul(fields[7].c_str(), NULL, 10) : 0;
+            entries_.push_back(std::move(e));
+        }
+    }
+
+    std::vector<JournalEntry> entries() {
+        std::lock_guard<decltype(mutex_)> lock(mutex_);
+        return entries_;
+    }
+
+    // Job queued, nothing imported yet (an existing checkpoint is kept)
+    void add(const std::string& directory) {
+        std::lock_guard<decltype(mutex_)> lock(mutex_);
+        if(find(directory)) return;
+        JournalEntry e;
+        e.directory = directory;
+        entries_.push_back(std::move(e));
+        save();
+    }
+
+    // Job finished or was cancelled, nothing to resume
+    void remove(const std::string& directory) {
+        std::lock_guard<decltype(mutex_)> lock(mutex_);
+        for(auto it = entries_.begin(); it != entries_.end(); ++it) {
+            if(it->directory != directory) continue;
+            entries_.erase(it);
+            save();
+            return;
+        }
+    }
+
+    bool checkpoint(const std::string& directory, JournalEntry& out) {
+        std::lock_guard<decltype(mutex_)> lock(mutex_);
+        JournalEntry* e = find(directory);
+        if(e == nullptr) return false;
+        out = *e;
+        return true;
+    }
+
+    // Before BEGIN: the next files files, ending with end_path, are about to
+    // use ids first..last
+    bool begin_batch(const std::string& directory, int first, int last, uint32_t files, const std::string& end_path) {
+        std::lock_guard<decltype(mutex_)> lock(mutex_);
+        JournalEntry* e = find(directory);
+        if(e == nullptr) return false;
+        e->batch_open = true;
+        e->batch_first = first;
+        e->batch_last = last;
+        e->batch_end = end_path;
+        e->batch_files = files;
+        return save();
+    }
+
+    // After COMMIT (or ROLLBACK, then files_done/last_path are unchanged)
+    bool end_batch(const std::string& directory, uint32_t files_done, const std::string& last_path) {
+        std::lock_guard<decltype(mutex_)> lock(mutex_);
+        JournalEntry* e = find(directory);
+        if(e == nullptr) return false;
+        e->files_done = files_done;
+        e->last_path = last_path;
+        e->batch_open = false;
+        e->batch_first = e->batch_last = 0;
+        e->batch_end.clear();
+        e->batch_files = 0;
+        return save();
+    }
+};
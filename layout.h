@@ -0,0 +1,97 @@
+#pragma once
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Where files start on the medium, so tags can be read in one sweep across
+// the card instead of seeking back and forth in directory hash order.
+
+enum class LayoutSource : uint8_t { Fiemap, Fibmap, Inode };
+
+// Sort key for the physical position of path's first byte. FIEMAP gives the
+// byte offset of the first extent; FIBMAP (needs root) the first block;
+// failing both the inode number, which on most filesystems grows with
+// allocation order. False if the file can't be opened.
+inline bool physical_offset(const char* path, uint64_t& offset, LayoutSource& source) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) return false;
+
+    // Room for the one extent we ask for
+    union {
+        struct fiemap map;
+        char bytes[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+    } request;
+    memset(&request, 0, sizeof(request));
+    request.map.fm_start = 0;
+    request.map.fm_length = ~0ULL;
+    request.map.fm_extent_count = 1;
+    if(ioctl(fd, FS_IOC_FIEMAP, &request.map) == 0 && request.map.fm_mapped_extents > 0) {
+        offset = request.map.fm_extents[0].fe_physical;
+        source = LayoutSource::Fiemap;
+        close(fd);
+        return true;
+    }
+
+    int block = 0;
+    if(ioctl(fd, FIBMAP, &block) == 0 && block > 0) {
+        struct stat st;
+        offset = (uint64_t)block * (fstat(fd, &st) == 0 ? st.st_blksize : 512);
+        source = LayoutSource::Fibmap;
+        close(fd);
+        return true;
+    }
+
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    close(fd);
+    if(!ok) return false;
+    offset = st.st_ino;
+    source = LayoutSource::Inode;
+    return true;
+}
+
+// How an ordering was worked out, for the log
+struct LayoutStats {
+    size_t fiemap = 0, fibmap = 0, inode = 0, failed = 0;
+};
+
+// Reorders files by where they start on the medium. Keys from different
+// sources don't compare, so files the fallback had to place go after the
+// mapped ones, each group in its own order; unreadable files go last. Ties
+// keep name order.
+inline LayoutStats order_by_layout(std::vector<std::string>& files) {
+    LayoutStats stats;
+    std::vector<std::pair<std::pair<int, uint64_t>, size_t>> keys; // (source rank, offset), index
+    keys.reserve(files.size());
+    for(size_t i = 0; i < files.size(); ++i) {
+        uint64_t offset = 0;
+        LayoutSource source;
+        if(!physical_offset(files[i].c_str(), offset, source)) {
+            stats.failed += 1;
+            keys.push_back({{3, 0}, i});
+            continue;
+        }
+        if(source == LayoutSource::Fiemap) stats.fiemap += 1;
+        else if(source == LayoutSource::Fibmap) stats.fibmap += 1;
+        else stats.inode += 1;
+        // FIEMAP and FIBMAP are both byte offsets on the device
+        keys.push_back({{source == LayoutSource::Inode ? 2 : 1, offset}, i});
+    }
+    std::stable_sort(keys.begin(), keys.end(), [](const auto& a, const auto& b){ return a.first < b.first; });
+
+    std::vector<std::string> ordered;
+    ordered.reserve(files.size());
+    for(auto& key : keys) ordered.push_back(std::move(files[key.second]));
+    files.swap(ordered);
+    return stats;
+}
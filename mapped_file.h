@@ -0,0 +1,52 @@
+#pragma once
+#include <stddef.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+
+// Read-only memory map of a whole file. Pages are only read from the card
+// when something touches them.
+class MappedFile {
+    void* data_ = MAP_FAILED;
+    size_t size_ = 0;
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& o) noexcept : data_(o.data_), size_(o.size_) {
+        o.data_ = MAP_FAILED;
+        o.size_ = 0;
+    }
+    ~MappedFile() { close(); }
+
+    // False with errno set on failure
+    bool open(const std::string& path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0) return false;
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        data_ = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd); // The mapping keeps its own reference
+        if(data_ == MAP_FAILED) return false;
+        size_ = st.st_size;
+        // Glyph lookups jump around, don't read ahead the whole font
+        madvise(data_, size_, MADV_RANDOM);
+        return true;
+    }
+
+    void close() {
+        if(data_ != MAP_FAILED) munmap(data_, size_);
+        data_ = MAP_FAILED;
+        size_ = 0;
+    }
+
+    const void* data() const { return data_ == MAP_FAILED ? nullptr : data_; }
+    size_t size() const { return size_; }
+};
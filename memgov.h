@@ -0,0 +1,163 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+
+// Sizes the memory hungry parts (rendered rows, sqlite's page cache, tracks
+// parsed ahead of a write, importers parsing at once) from what the system
+// has free, so a long import on the player stays clear of the OOM killer and
+// one on a desktop isn't held to the player's limits.
+
+struct MemoryInfo {
+    uint64_t total_kb = 0;
+    uint64_t available_kb = 0; // What can be had without swapping
+    uint64_t rss_kb = 0;       // Ours
+};
+
+// Resident set size from /proc, 0 if unknown
+inline uint64_t self_rss_kb() {
+    FILE* file = fopen("/proc/self/status", "r");
+    if(file == NULL) return 0;
+    char line[128];
+    uint64_t rss = 0;
+    while(fgets(line, sizeof(line), file) != NULL) {
+        if(strncmp(line, "VmRSS:", 6) == 0) {
+            rss = strtoull(line + 6, NULL, 10);
+            break;
+        }
+    }
+    fclose(file);
+    return rss;
+}
+
+// False if /proc/meminfo can't be read
+inline bool read_memory_info(MemoryInfo& info) {
+    FILE* file = fopen("/proc/meminfo", "r");
+    if(file == NULL) return false;
+    char line[128];
+    uint64_t available = 0, free = 0, buffers = 0, cached = 0;
+    bool has_available = false;
+    while(fgets(line, sizeof(line), file) != NULL) {
+        char* colon = strchr(line, ':');
+        if(colon == NULL) continue;
+        *colon = '\0';
+        uint64_t kb = strtoull(colon + 1, NULL, 10);
+        if(strcmp(line, "MemTotal") == 0) info.total_kb = kb;
+        else if(strcmp(line, "MemAvailable") == 0) available = kb, has_available = true;
+        else if(strcmp(line, "MemFree") == 0) free = kb;
+        else if(strcmp(line, "Buffers") == 0) buffers = kb;
+        else if(strcmp(line, "Cached") == 0) cached = kb;
+    }
+    fclose(file);
+    // Kernels before 3.14 have no MemAvailable, the page cache is the
+    // closest guess there
+    info.available_kb = has_available ? available : free + buffers + cached;
+    info.rss_kb = self_rss_kb();
+    return info.total_kb > 0;
+}
+
+// What each part may use
+struct MemoryBudget {
+    size_t row_cache = 400 * 1024; // Bytes of rendered rows
+    int sqlite_cache_kb = 2000;    // PRAGMA cache_size, sqlite's default
+    size_t batch = 32;             // Tracks parsed ahead and written per transaction
+    bool one_parser = false;       // Importers take turns parsing
+
+    bool operator==(const MemoryBudget& other) const {
+        return row_cache == other.row_cache && sqlite_cache_kb == other.sqlite_cache_kb &&
+            batch == other.batch && one_parser == other.one_parser;
+    }
+    bool operator!=(const MemoryBudget& other) const { return !(*this == other); }
+};
+
+class MemoryGovernor {
+    // Left to the firmware and the kernel whatever happens
+    static constexpr uint64_t RESERVE_KB = 8 * 1024;
+    // Parsed track with its TagLib objects and strings, roughly
+    static constexpr uint64_t TRACK_KB = 512;
+    static constexpr std::chrono::seconds INTERVAL{1};
+
+    mutable std::mutex mutex_;
+    std::condition_variable parser_free_;
+    MemoryBudget budget_{};
+    MemoryInfo info_{};
+    std::chrono::steady_clock::time_point checked_{};
+    size_t parsing_ = 0;
+
+    static MemoryBudget budget_for(const MemoryInfo& info) {
+        // Free memory less the reserve, and no more than three quarters of
+        // RAM for the whole process
+        uint64_t headroom = info.available_kb > RESERVE_KB ? info.available_kb - RESERVE_KB : 0;
+        uint64_t share = info.total_kb / 4 * 3;
+        headroom = std::min(headroom, share > info.rss_kb ? share - info.rss_kb : 0);
+        // Whole powers of two, so small swings don't retune everything
+        uint64_t step = 1024;
+        while(step * 2 <= headroom) step *= 2;
+        headroom = headroom < 1024 ? 0 : step;
+
+        MemoryBudget budget;
+        budget.row_cache = (size_t)std::min<uint64_t>(std::max<uint64_t>(headroom / 16, 64), 4096) * 1024;
+        budget.sqlite_cache_kb = (int)std::min<uint64_t>(std::max<uint64_t>(headroom / 8, 256), 32768);
+        budget.batch = (size_t)std::min<uint64_t>(std::max<uint64_t>(headroom / TRACK_KB, 4), 256);
+        budget.one_parser = headroom < 32 * 1024;
+        return budget;
+    }
+
+public:
+    // Budget for what's free now, re-read at most once per INTERVAL.
+    // Changes are logged.
+    MemoryBudget update() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto now = std::chrono::steady_clock::now();
+        bool first = checked_ == std::chrono::steady_clock::time_point{};
+        if(!first && now - checked_ < INTERVAL) return budget_;
+        checked_ = now;
+        MemoryInfo info;
+        if(!read_memory_info(info)) return budget_;
+        info_ = info;
+        MemoryBudget budget = budget_for(info);
+        if(budget != budget_) {
+            bool throttled = budget.batch < budget_.batch || budget.sqlite_cache_kb < budget_.sqlite_cache_kb ||
+                budget.row_cache < budget_.row_cache || (budget.one_parser && !budget_.one_parser);
+            std::cout << "Memory " << (first ? "budget" : throttled ? "tight, throttling" : "freed") << ": "
+                << info.available_kb << "kB available, RSS " << info.rss_kb << "kB -> batches of " << budget.batch << ", " << budget.sqlite_cache_kb << "kB sqlite cache, "
+                << budget.row_cache / 1024 << "kB row cache" << (budget.one_parser ? ", one parser" : "") << "\n";
+            if(!budget.one_parser) parser_free_.notify_all();
+            budget_ = budget;
+        }
+        return budget_;
+    }
+
+    MemoryBudget budget() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return budget_;
+    }
+
+    MemoryInfo info() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return info_;
+    }
+
+    // Around an importer's parsing, waits while another one parses if
+    // memory is tight
+    void begin_parse() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        parser_free_.wait(lock, [&]{ return !budget_.one_parser || parsing_ == 0; });
+        parsing_ += 1;
+    }
+
+    void end_parse() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            parsing_ -= 1;
+        }
+        parser_free_.notify_one();
+    }
+};
@@ -0,0 +1,193 @@
+#pragma once
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Full speed for the length of an import: the cpufreq governor switched to
+// performance (or without one, the minimum frequency raised to the maximum),
+// and optionally the panel blanked until it's touched. What gets changed is
+// written to a state file first, so a crash is undone at the next start
+// (recover()) and a fatal signal undoes it on the way out. The sysfs root
+// can point at a fake tree for testing.
+class PowerSession {
+    // Governor and minimum frequency of 8 CPUs, and the panel
+    static constexpr int MAX_SAVED = 17;
+    struct Saved {
+        char path[192];
+        char value[64];
+    };
+
+    std::string root_;
+    char state_path_[192];
+    bool blank_ = false;
+    std::mutex mutex_;
+    // Filled in before the count is bumped, the signal handler reads up to it
+    Saved saved_[MAX_SAVED];
+    std::atomic<int> saved_count_{0};
+    std::atomic<bool> active_{false}, blanked_{false};
+    static inline std::atomic<PowerSession*> instance_{nullptr};
+
+    static bool read_file(const std::string& path, std::string& out) {
+        std::ifstream file(path, std::ios::binary);
+        if(!file) return false;
+        out.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        while(!out.empty() && (out.back() == '\n' || out.back() == ' ')) out.pop_back();
+        return true;
+    }
+
+    // Only async-signal-safe calls, the signal handler uses it too. O_TRUNC
+    // is a no-op on sysfs, it's for a fake tree of plain files.
+    static bool write_file(const char* path, const char* value) {
+        int fd = open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+        if(fd < 0) return false;
+        size_t size = strlen(value);
+        bool ok = write(fd, value, size) == (ssize_t)size;
+        close(fd);
+        return ok;
+    }
+
+    bool set(const std::string& path, const std::string& value) {
+        if(write_file(path.c_str(), value.c_str())) return true;
+        std::cout << "Can't write " << value << " to " << path << " - " << strerror(errno) << "\n";
+        return false;
+    }
+
+    // Records what to put back at path, in the state file too. False if
+    // it couldn't be recorded, then path is better left alone.
+    bool save(const std::string& path, const std::string& value) {
+        int count = saved_count_.load();
+        if(count == MAX_SAVED || path.size() >= sizeof(Saved::path) || value.size() >= sizeof(Saved::value)) return false;
+        snprintf(saved_[count].path, sizeof(Saved::path), "%s", path.c_str());
+        snprintf(saved_[count].value, sizeof(Saved::value), "%s", value.c_str());
+        saved_count_.store(count + 1);
+
+        // Replaced in one go, a crash leaves the old or the new list
+        std::string temp = std::string(state_path_) + ".tmp";
+        FILE* file = fopen(temp.c_str(), "w");
+        bool ok = file != NULL;
+        for(int i = 0; ok && i <= count; ++i)
+            ok = fprintf(file, "%s\t%s\n", saved_[i].path, saved_[i].value) > 0;
+        if(file != NULL) {
+            ok = fflush(file) == 0 && fsync(fileno(file)) == 0 && ok;
+            ok = fclose(file) == 0 && ok;
+        }
+        if(ok && rename(temp.c_str(), state_path_) == 0) return true;
+        std::cout << "Can't write " << state_path_ << " - " << strerror(errno) << "\n";
+        saved_count_.store(count);
+        return false;
+    }
+
+    // Newest first, async-signal-safe
+    void restore_saved() {
+        for(int i = saved_count_.exchange(0) - 1; i >= 0; --i)
+            write_file(saved_[i].path, saved_[i].value);
+        unlink(state_path_);
+    }
+
+    void boost_cpu(const std::string& cpufreq) {
+        std::string governor, governors;
+        if(!read_file(cpufreq + "scaling_governor", governor)) return;
+        read_file(cpufreq + "scaling_available_governors", governors);
+        if((" " + governors + " ").find(" performance ") != std::string::npos) {
+            if(governor != "performance" && save(cpufreq + "scaling_governor", governor))
+                set(cpufreq + "scaling_governor", "performance");
+            return;
+        }
+        std::string min_freq, max_freq;
+        if(!read_file(cpufreq + "scaling_min_freq", min_freq) || !read_file(cpufreq + "scaling_max_freq", max_freq)) return;
+        if(min_freq != max_freq && save(cpufreq + "scaling_min_freq", min_freq))
+            set(cpufreq + "scaling_min_freq", max_freq);
+    }
+
+    static void on_fatal_signal(int signal) {
+        if(PowerSession* session = instance_.load()) session->restore_saved();
+        // The handler was reset, this time it's the default action
+        raise(signal);
+    }
+
+public:
+    explicit PowerSession(std::string root = "/sys", const char* state_path = "/data/tagadder.power")
+        : root_(std::move(root)) {
+        snprintf(state_path_, sizeof(state_path_), "%s", state_path);
+    }
+
+    // Blank the panel while importing, off by default
+    void set_blank(bool blank) { blank_ = blank; }
+
+    // Puts back what a run that didn't get to end() left changed
+    void recover() {
+        std::ifstream state(state_path_);
+        if(!state) return;
+        std::string line;
+        int restored = 0;
+        // Saved in order, put back newest first
+        std::vector<std::pair<std::string, std::string>> entries;
+        while(std::getline(state, line)) {
+            size_t tab = line.find('\t');
+            if(tab != std::string::npos) entries.emplace_back(line.substr(0, tab), line.substr(tab + 1));
+        }
+        for(auto it = entries.rbegin(); it != entries.rend(); ++it)
+            restored += set(it->first, it->second);
+        unlink(state_path_);
+        std::cout << "Restored " << restored << " power settings left by an earlier run\n";
+    }
+
+    // Fatal signals restore the settings before the process goes
+    static void install_handlers() {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = on_fatal_signal;
+        action.sa_flags = SA_RESETHAND;
+        sigemptyset(&action.sa_mask);
+        for(int signal : {SIGTERM, SIGINT, SIGHUP, SIGQUIT, SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT})
+            sigaction(signal, &action, NULL);
+    }
+
+    // Idempotent, at the start of every job
+    void begin() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(active_.load()) return;
+        active_.store(true);
+        instance_.store(this);
+        for(int cpu = 0; cpu < 8; ++cpu)
+            boost_cpu(root_ + "/devices/system/cpu/cpu" + std::to_string(cpu) + "/cpufreq/");
+        std::string blank = root_ + "/class/graphics/fb0/blank";
+        if(blank_ && save(blank, "0") && set(blank, "1")) blanked_.store(true);
+        std::cout << "Power session: " << saved_count_.load() << " settings changed"
+            << (blanked_.load() ? ", display off until touched" : "") << "\n";
+    }
+
+    // Once nothing is left to import
+    void end() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(!active_.load()) return;
+        restore_saved();
+        blanked_.store(false);
+        active_.store(false);
+        std::cout << "Power session over\n";
+    }
+
+    // Turns a blanked panel back on, true if it was off (the touch that did
+    // it shouldn't count as a tap)
+    bool wake() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(!blanked_.load()) return false;
+        set(root_ + "/class/graphics/fb0/blank", "0");
+        blanked_.store(false);
+        return true;
+    }
+
+    // Nothing to render while the panel is off
+    bool blanked() const { return blanked_.load(); }
+};
@@ -0,0 +1,150 @@
+#pragma once
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern char** environ;
+
+// Finds, stops and starts processes through /proc instead of ps/grep/kill in a
+// shell
+class ProcessControl {
+    static bool read_file(const std::string& path, std::string& out) {
+        std::ifstream file(path, std::ios::binary);
+        if(!file) return false;
+        out.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    static bool alive(pid_t pid) {
+        std::string stat;
+        if(!read_file("/proc/" + std::to_string(pid) + "/stat", stat)) return false;
+        // State follows the parenthesised comm, a zombie is as good as gone
+        size_t paren = stat.rfind(')');
+        return paren == std::string::npos || paren + 2 >= stat.size() || stat[paren + 2] != 'Z';
+    }
+
+    // Block until pid exits or the deadline passes
+    static bool wait_exit(pid_t pid, std::chrono::steady_clock::time_point deadline) {
+#ifdef SYS_pidfd_open
+        int fd = syscall(SYS_pidfd_open, pid, 0);
+        if(fd >= 0) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now()).count();
+            struct pollfd monitor = {fd, POLLIN, 0};
+            int ready = poll(&monitor, 1, left > 0 ? (int)left : 0);
+            close(fd);
+            if(ready > 0) return true;
+            return !alive(pid);
+        }
+        // ENOSYS on older kernels, ESRCH if it's already gone
+        if(errno == ESRCH) return true;
+#endif
+        while(alive(pid)) {
+            if(std::chrono::steady_clock::now() >= deadline) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return true;
+    }
+
+public:
+    // Processes whose comm is name or whose command line contains it (like
+    // grepping ps), never this process
+    static std::vector<pid_t> find(const std::string& name) {
+        std::vector<pid_t> pids;
+        DIR* dir = opendir("/proc");
+        if(dir == NULL) return pids;
+        pid_t self = getpid();
+        while(struct dirent* ent = readdir(dir)) {
+            char* end;
+            long pid = strtol(ent->d_name, &end, 10);
+            if(*end != '\0' || pid <= 0 || pid == self) continue;
+
+            std::string base = std::string("/proc/") + ent->d_name;
+            std::string comm, cmdline;
+            if(read_file(base + "/comm", comm)) {
+                if(!comm.empty() && comm.back() == '\n') comm.pop_back();
+                if(comm == name) {
+                    pids.push_back(pid);
+                    continue;
+                }
+            }
+            if(read_file(base + "/cmdline", cmdline)) {
+                // Arguments are NUL separated
+                for(auto& c : cmdline) if(c == '\0') c = ' ';
+                if(cmdline.find(name) != std::string::npos) pids.push_back(pid);
+            }
+        }
+        closedir(dir);
+        return pids;
+    }
+
+    // SIGTERM everything matching names, SIGKILL whatever is left after
+    // timeout. True once all of them are gone.
+    static bool terminate(const std::vector<std::string>& names, std::chrono::milliseconds timeout) {
+        std::vector<pid_t> pids;
+        for(auto& name : names) {
+            auto found = find(name);
+            pids.insert(pids.end(), found.begin(), found.end());
+        }
+        for(pid_t pid : pids) {
+            std::cout << "Stopping " << pid << "\n";
+            kill(pid, SIGTERM);
+        }
+
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        bool all_gone = true;
+        for(pid_t pid : pids) {
+            if(wait_exit(pid, deadline)) continue;
+            std::cout << "Killing " << pid << "\n";
+            kill(pid, SIGKILL);
+            all_gone = wait_exit(pid, std::chrono::steady_clock::now() + std::chrono::milliseconds(500)) && all_gone;
+        }
+        return all_gone;
+    }
+
+    // Start argv[0] in its own session so it outlives us, without a shell
+    static bool spawn_detached(const std::vector<std::string>& args) {
+        std::vector<char*> argv;
+        for(auto& arg : args) argv.push_back(const_cast<char*>(arg.c_str()));
+        argv.push_back(nullptr);
+
+        posix_spawnattr_t attr;
+        posix_spawnattr_init(&attr);
+        short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+#ifdef POSIX_SPAWN_SETSID
+        flags |= POSIX_SPAWN_SETSID;
+#endif
+        posix_spawnattr_setflags(&attr, flags);
+        sigset_t signals;
+        sigemptyset(&signals);
+        posix_spawnattr_setsigmask(&attr, &signals);
+        sigaddset(&signals, SIGHUP);
+        sigaddset(&signals, SIGPIPE);
+        posix_spawnattr_setsigdefault(&attr, &signals);
+
+        pid_t pid;
+        int rc = posix_spawn(&pid, argv[0], NULL, &attr, argv.data(), environ);
+        posix_spawnattr_destroy(&attr);
+        if(rc != 0) {
+            std::cout << "Can't start " << args[0] << " - " << strerror(rc) << "\n";
+            return false;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,162 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+// Copy into a fixed size NUL terminated buffer, cut on a UTF-8 boundary
+template<size_t N>
+void copy_utf8(char (&dst)[N], const std::string& src) {
+    size_t len = std::min(src.size(), N - 1);
+    // Don't leave half a multibyte sequence at the end
+    while(len > 0 && len < src.size() && (src[len] & 0xc0) == 0x80) --len;
+    memcpy(dst, src.data(), len);
+    dst[len] = '\0';
+}
+
+// Import progress, copied by value from the importer to the render thread
+struct ProgressSnapshot {
+    bool active = false;
+    uint32_t files_done = 0;
+    uint32_t files_total = 0;
+    uint64_t bytes_done = 0;
+    float tracks_per_sec = 0.f;
+    uint32_t eta_sec = 0;
+    char title[128] = {}; // NUL terminated, cut on a UTF-8 boundary
+
+    void set_title(const std::string& str) { copy_utf8(title, str); }
+};
+static_assert(std::is_trivially_copyable<ProgressSnapshot>::value, "snapshots are copied between threads");
+
+// Bounded single-producer/single-consumer ring, no locks
+template<typename T, size_t N>
+class SpscRing {
+    static_assert((N & (N - 1)) == 0, "size must be a power of two");
+    std::array<T, N> slots_;
+    std::atomic<size_t> head_{0}; // next slot to read, owned by consumer
+    std::atomic<size_t> tail_{0}; // next slot to write, owned by producer
+
+public:
+    // Producer only. False if the consumer hasn't caught up.
+    bool push(const T& item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if(tail - head_.load(std::memory_order_acquire) == N) return false;
+        slots_[tail & (N - 1)] = item;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only
+    bool pop(T& item) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if(head == tail_.load(std::memory_order_acquire)) return false;
+        item = slots_[head & (N - 1)];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+// Producer side helper: counts files/bytes, derives rate + ETA and only
+// publishes at most every PUBLISH_INTERVAL so the importer isn't slowed down.
+// Imports running at the same time add up into one bar; only one thread may
+// produce at a time (the importers hold the db lock).
+class ProgressChannel {
+    static constexpr std::chrono::milliseconds PUBLISH_INTERVAL{100};
+    SpscRing<ProgressSnapshot, 8> ring_;
+
+    // Producer state
+    ProgressSnapshot current_{};
+    int imports_ = 0; // Between begin() and finish()
+    bool pending_ = false; // current_ not delivered yet
+    std::chrono::steady_clock::time_point start_{}, last_publish_{};
+
+    bool flush() {
+        pending_ = !ring_.push(current_);
+        last_publish_ = std::chrono::steady_clock::now();
+        return !pending_;
+    }
+
+    // Rate and ETA over all files counted so far, publishes when it's time
+    bool advance(uint32_t files) {
+        current_.files_done += files;
+
+        auto now = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(now - start_).count();
+        if(elapsed > 0) {
+            current_.tracks_per_sec = current_.files_done / elapsed;
+            uint32_t left = current_.files_total > current_.files_done
+                ? current_.files_total - current_.files_done : 0;
+            current_.eta_sec = (uint32_t)(left / current_.tracks_per_sec);
+        }
+
+        if(!pending_ && now - last_publish_ < PUBLISH_INTERVAL) return false;
+        return flush();
+    }
+
+public:
+    //// Producer
+
+    void begin(uint32_t files_total) {
+        if(imports_++ > 0) {
+            current_.files_total += files_total;
+            flush();
+            return;
+        }
+        current_ = ProgressSnapshot{};
+        current_.active = true;
+        current_.files_total = files_total;
+        start_ = std::chrono::steady_clock::now();
+        flush();
+    }
+
+    // Returns true when a snapshot was published (the consumer should be woken)
+    bool track_done(const std::string& title, uint64_t bytes) {
+        current_.bytes_done += bytes;
+        current_.set_title(title);
+        return advance(1);
+    }
+
+    // Files counted in begin() that weren't imported (already in the db, or
+    // not readable), so the bar still gets to the end. Same return.
+    bool files_skipped(uint32_t count) {
+        if(count == 0) return false;
+        return advance(count);
+    }
+
+    // One try at publishing the end of an import. False if the ring was
+    // full; the final snapshot should get through, so the caller retries
+    // with deliver_pending() once the consumer had a moment to drain,
+    // without holding anything that stalls the other importer.
+    bool finish() {
+        if(imports_ > 1) {
+            imports_ -= 1;
+            return flush();
+        }
+        imports_ = 0;
+        current_.active = false;
+        current_.eta_sec = 0;
+        return flush();
+    }
+
+    // Publishes a snapshot a full ring held back, true once nothing is
+    // pending. A later begin() may have replaced it, the newest one goes.
+    bool deliver_pending() {
+        return !pending_ || flush();
+    }
+
+    static constexpr std::chrono::milliseconds retry_interval() { return PUBLISH_INTERVAL; }
+
+    //// Consumer
+
+    // Drain to the newest snapshot, false if nothing new
+    bool latest(ProgressSnapshot& out) {
+        bool got = false;
+        while(ring_.pop(out)) got = true;
+        return got;
+    }
+};
@@ -0,0 +1,71 @@
+#pragma once
+#include <string>
+
+#include <sqlite3.h>
+#include "schema.h"
+#include "sortkey.h"
+
+// Regenerates the album and artist tables from MEDIA_TABLE in a few set based
+// statements, for when the incremental cn bumps have drifted. Each album or
+// artist gets the id, create and modified of its earliest track, and rows are
+// inserted in TAGKEY order (the firmware lists them in table order).
+
+namespace rebuild_detail {
+
+// Stored text carries its NUL terminator, results keep that convention
+inline std::string stored_text(sqlite3_value* value) {
+    const char* text = (const char*)sqlite3_value_text(value);
+    std::string str(text ? text : "", sqlite3_value_bytes(value));
+    while(!str.empty() && str.back() == '\0') str.pop_back();
+    return str;
+}
+
+inline void tag_letter(sqlite3_context* context, int, sqlite3_value** args) {
+    char letter = index_letter(stored_text(args[0]));
+    sqlite3_result_text(context, &letter, 1, SQLITE_TRANSIENT);
+}
+
+inline void tag_romanize(sqlite3_context* context, int, sqlite3_value** args) {
+    std::string key = romanize(stored_text(args[0]));
+    sqlite3_result_text(context, key.data(), key.size() + 1, SQLITE_TRANSIENT);
+}
+
+} // namespace rebuild_detail
+
+// tag_letter(text) and tag_romanize(text), what the importer binds to the
+// character and pinyin columns
+inline bool register_sortkey_functions(sqlite3* db) {
+    const int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC;
+    return sqlite3_create_function(db, "tag_letter", 1, flags, NULL, rebuild_detail::tag_letter, NULL, NULL) == SQLITE_OK &&
+        sqlite3_create_function(db, "tag_romanize", 1, flags, NULL, rebuild_detail::tag_romanize, NULL, NULL) == SQLITE_OK;
+}
+
+// Statements emptying and refilling ALBUM(2)_TABLE and ARTIST(2)_TABLE, to be
+// run in one transaction. Needs register_sortkey_functions and TAGKEY
+// (collation.h) on the connection. Empty if MEDIA_TABLE isn't laid out as
+// expected.
+inline std::string rebuild_indexes_sql(sqlite3* db) {
+    std::string album = column_name(db, "MEDIA_TABLE", 3);
+    std::string artist = column_name(db, "MEDIA_TABLE", 4);
+    std::string created = column_name(db, "MEDIA_TABLE", 25);
+    std::string modified = column_name(db, "MEDIA_TABLE", 26);
+    if(album.empty() || artist.empty() || created.empty() || modified.empty()) return "";
+
+    // With MIN() the bare columns come from the row holding the minimum,
+    // i.e. the earliest track
+    auto group = [&](const std::string& column) {
+        std::string name = quote_name(column);
+        return "SELECT MIN(id), " + name + ", tag_letter(" + name + "), COUNT(*), " + quote_name(created) + ", " +
+            quote_name(modified) + ", %s tag_romanize(" + name + ") FROM MEDIA_TABLE GROUP BY " + name +
+            " ORDER BY " + name + " COLLATE TAGKEY ASC, MIN(id);";
+    };
+    std::string albums = group(album), artists = group(artist);
+    // Albums have an extra (always 0) column before pinyin
+    albums.replace(albums.find("%s"), 2, "0,");
+    artists.replace(artists.find("%s"), 2, "");
+
+    return "DELETE FROM ALBUM_TABLE; INSERT INTO ALBUM_TABLE " + albums +
+        "DELETE FROM ALBUM2_TABLE; INSERT INTO ALBUM2_TABLE SELECT * FROM ALBUM_TABLE ORDER BY rowid;"
+        "DELETE FROM ARTIST_TABLE; INSERT INTO ARTIST_TABLE " + artists +
+        "DELETE FROM ARTIST2_TABLE; INSERT INTO ARTIST2_TABLE SELECT * FROM ARTIST_TABLE ORDER BY rowid;";
+}
@@ -0,0 +1,238 @@
+#pragma once
+#include <dirent.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sqlite3.h>
+#include "schema.h"
+
+// Walks a directory tree and yields its files with their db paths
+// ("a:\dir\file"), in the byte order of those paths. Children are sorted by
+// name with directories sorting as name + '\'. Memory is one sorted listing
+// per directory level.
+class SortedFileWalker {
+    struct Level {
+        std::string dir;    // Filesystem path, ending in '/'
+        std::string key;    // db path so far, ending in '\'
+        std::vector<std::pair<std::string, bool>> children; // sort key, is directory
+        size_t next = 0;
+    };
+    std::vector<Level> stack_;
+    std::function<bool(const std::string&)> want_;
+    bool failed_ = false;
+    uint64_t files_ = 0;
+
+    void push(std::string dir, std::string key) {
+        Level level;
+        level.dir = std::move(dir);
+        level.key = std::move(key);
+        if(DIR* handle = opendir(level.dir.c_str())) {
+            while(struct dirent* ent = readdir(handle)) {
+                std::string name = ent->d_name;
+                if(name == "." || name == "..") continue;
+                bool is_dir = ent->d_type == DT_DIR;
+                if(ent->d_type == DT_UNKNOWN) {
+                    struct stat st;
+                    is_dir = stat((level.dir + name).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+                }
+                if(is_dir) level.children.emplace_back(name + '\\', true);
+                else if(want_(name)) level.children.emplace_back(name, false);
+            }
+            closedir(handle);
+        } else {
+            std::cout << "Can't list " << level.dir << "\n";
+            failed_ = true;
+        }
+        std::sort(level.children.begin(), level.children.end());
+        stack_.push_back(std::move(level));
+    }
+
+public:
+    // want(name) picks the files to yield, key_prefix is what the db puts in
+    // front of paths relative to root
+    SortedFileWalker(std::string root, std::string key_prefix, std::function<bool(const std::string&)> want)
+        : want_(std::move(want)) {
+        if(root.empty() || root.back() != '/') root += '/';
+        push(std::move(root), std::move(key_prefix));
+    }
+
+    // Next file, false once the tree is exhausted
+    bool next(std::string& path, std::string& key) {
+        while(!stack_.empty()) {
+            Level& level = stack_.back();
+            if(level.next == level.children.size()) {
+                stack_.pop_back();
+                continue;
+            }
+            auto& child = level.children[level.next++];
+            if(child.second) {
+                std::string name = child.first.substr(0, child.first.size() - 1);
+                // push invalidates level
+                std::string dir = level.dir + name + '/', child_key = level.key + child.first;
+                push(std::move(dir), std::move(child_key));
+                continue;
+            }
+            path = level.dir + child.first;
+            key = level.key + child.first;
+            files_ += 1;
+            return true;
+        }
+        return false;
+    }
+
+    // A directory couldn't be listed, its files would look deleted
+    bool failed() const { return failed_; }
+    uint64_t files() const { return files_; }
+};
+
+struct ReconcileStats {
+    uint64_t rows = 0;       // MEDIA_TABLE rows under the prefix
+    uint64_t missing = 0;    // Whose file is gone (deleted or renamed)
+    uint64_t duplicates = 0; // Same path as an earlier row
+};
+
+// Merge-joins the files under root against MEDIA_TABLE rows whose path starts
+// with key_prefix, both in path order, and lists the rows to delete (id,
+// album, artist as stored) in temp.RECONCILE_GONE. Nothing else is modified.
+// The rows are copied (id, path) in path order to temp.RECONCILE_ROWS first,
+// then read back a chunk at a time; db_mutex is only held for those steps,
+// not while the card is walked. A row that changed its path or went away
+// meanwhile isn't listed. keep_going is polled every chunk; false from it, or
+// any error, returns false.
+inline bool find_orphans(sqlite3* db, std::mutex& db_mutex, const std::string& root, const std::string& key_prefix,
+        std::function<bool(const std::string&)> want, std::function<bool()> keep_going, ReconcileStats& stats) {
+    const int CHUNK = 256;
+    std::unique_lock<std::mutex> lock(db_mutex);
+    std::string path_col = column_name(db, "MEDIA_TABLE", 1);
+    std::string album_col = column_name(db, "MEDIA_TABLE", 3);
+    std::string artist_col = column_name(db, "MEDIA_TABLE", 4);
+    if(path_col.empty() || album_col.empty() || artist_col.empty()) {
+        std::cout << "Unexpected MEDIA_TABLE layout\n";
+        return false;
+    }
+
+    // Only this volume's rows: prefix <= path < prefix with its last byte
+    // bumped. Inserted in byte order of the path, so rowid order is path order
+    // and repeats of a path come together.
+    std::string upper = key_prefix;
+    upper.back() += 1;
+    std::string setup = "CREATE TEMP TABLE IF NOT EXISTS RECONCILE_GONE(id INTEGER PRIMARY KEY, album, artist);"
+        "CREATE TEMP TABLE IF NOT EXISTS RECONCILE_ROWS(id INTEGER, path);"
+        "DELETE FROM temp.RECONCILE_GONE;"
+        "DELETE FROM temp.RECONCILE_ROWS;";
+    std::string snapshot = "INSERT INTO temp.RECONCILE_ROWS SELECT id, " + quote_name(path_col) + " FROM MEDIA_TABLE WHERE " +
+        quote_name(path_col) + " >= ? AND " + quote_name(path_col) + " < ? ORDER BY " + quote_name(path_col) + " COLLATE BINARY;";
+    const char* chunk = "SELECT rowid, path FROM temp.RECONCILE_ROWS WHERE rowid > ? ORDER BY rowid LIMIT ?;";
+    // Listed with what MEDIA_TABLE holds now, if the row is still there as it was
+    std::string record = "INSERT OR IGNORE INTO temp.RECONCILE_GONE SELECT m.id, m." + quote_name(album_col) + ", m." + quote_name(artist_col) +
+        " FROM temp.RECONCILE_ROWS r JOIN MEDIA_TABLE m ON m.id = r.id AND m." + quote_name(path_col) + " = r.path WHERE r.rowid = ?;";
+
+    char* errmsg = NULL;
+    sqlite3_exec(db, setup.c_str(), NULL, NULL, &errmsg);
+    if(errmsg != NULL) {
+        std::cout << "Can't set up reconcile - " << errmsg << "\n";
+        sqlite3_free(errmsg);
+        return false;
+    }
+    sqlite3_stmt *copy = NULL, *rows = NULL, *gone = NULL;
+    auto finalize = [&]{
+        sqlite3_finalize(copy);
+        sqlite3_finalize(rows);
+        sqlite3_finalize(gone);
+    };
+    if(sqlite3_prepare_v2(db, snapshot.c_str(), snapshot.size(), &copy, NULL) != SQLITE_OK ||
+            sqlite3_prepare_v2(db, chunk, strlen(chunk), &rows, NULL) != SQLITE_OK ||
+            sqlite3_prepare_v2(db, record.c_str(), record.size(), &gone, NULL) != SQLITE_OK) {
+        std::cout << "Can't read MEDIA_TABLE - " << sqlite3_errmsg(db) << "\n";
+        finalize();
+        return false;
+    }
+    sqlite3_bind_text(copy, 1, key_prefix.data(), key_prefix.size(), SQLITE_STATIC);
+    sqlite3_bind_text(copy, 2, upper.data(), upper.size(), SQLITE_STATIC);
+    if(sqlite3_step(copy) != SQLITE_DONE) {
+        std::cout << "Reading MEDIA_TABLE failed - " << sqlite3_errmsg(db) << "\n";
+        finalize();
+        return false;
+    }
+    lock.unlock();
+
+    SortedFileWalker walker(root, key_prefix, std::move(want));
+    std::string file, file_key, last_matched;
+    bool have_file = walker.next(file, file_key);
+    // Snapshot rowids of the rows to delete, recorded once the walk is over
+    std::vector<int64_t> orphans;
+    std::vector<std::pair<int64_t, std::string>> batch;
+    int64_t after = 0;
+    bool ok = true;
+    while(ok) {
+        batch.clear();
+        lock.lock();
+        sqlite3_bind_int64(rows, 1, after);
+        sqlite3_bind_int(rows, 2, CHUNK);
+        int rc;
+        while((rc = sqlite3_step(rows)) == SQLITE_ROW) {
+            // Paths are stored with their NUL terminator
+            const char* text = (const char*)sqlite3_column_text(rows, 1);
+            batch.emplace_back(sqlite3_column_int64(rows, 0), std::string(text ? text : "", sqlite3_column_bytes(rows, 1)));
+        }
+        sqlite3_reset(rows);
+        if(rc != SQLITE_DONE) {
+            std::cout << "Reading MEDIA_TABLE failed - " << sqlite3_errmsg(db) << "\n";
+            ok = false;
+        }
+        lock.unlock();
+        if(!ok || batch.empty()) break;
+
+        for(auto& row : batch) {
+            std::string& key = row.second;
+            if(!key.empty() && key.back() == '\0') key.pop_back();
+            stats.rows += 1;
+
+            // Files not imported yet are the importer's business
+            while(have_file && file_key < key)
+                have_file = walker.next(file, file_key);
+
+            if(!last_matched.empty() && key == last_matched) {
+                stats.duplicates += 1;
+            } else if(have_file && key == file_key) {
+                last_matched = key;
+                have_file = walker.next(file, file_key);
+                continue;
+            } else {
+                stats.missing += 1;
+            }
+            orphans.push_back(row.first);
+        }
+        after = batch.back().first;
+        ok = keep_going();
+    }
+
+    // Every directory sorting before the last row has been listed by now.
+    // Don't empty the library because the card isn't mounted or readable.
+    if(ok && (walker.failed() || (walker.files() == 0 && stats.rows > 0))) {
+        std::cout << "Couldn't read all of " << root << ", not deleting anything\n";
+        ok = false;
+    }
+
+    lock.lock();
+    for(size_t i = 0; ok && i < orphans.size(); ++i) {
+        sqlite3_bind_int64(gone, 1, orphans[i]);
+        if(sqlite3_step(gone) != SQLITE_DONE) {
+            std::cout << "Can't record orphan - " << sqlite3_errmsg(db) << "\n";
+            ok = false;
+        }
+        sqlite3_reset(gone);
+    }
+    sqlite3_exec(db, "DELETE FROM temp.RECONCILE_ROWS;", NULL, NULL, NULL);
+    finalize();
+    return ok;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <sqlite3.h>
+#include <string>
+
+// The firmware's tables are only known by column position (the inserts are
+// positional), look names up when a query needs them
+
+// Name of the column at index (0 based) in table, empty if there is none
+inline std::string column_name(sqlite3* db, const char* table, int index) {
+    std::string query = std::string("PRAGMA table_info(") + table + ");";
+    sqlite3_stmt* stmt;
+    if(sqlite3_prepare_v2(db, query.c_str(), query.size(), &stmt, NULL) != SQLITE_OK) return "";
+    std::string name;
+    while(sqlite3_step(stmt) == SQLITE_ROW) {
+        if(sqlite3_column_int(stmt, 0) == index) {
+            name = (const char*)sqlite3_column_text(stmt, 1);
+            break;
+        }
+    }
+    sqlite3_finalize(stmt);
+    return name;
+}
+
+// Identifier quoted for splicing into SQL
+inline std::string quote_name(const std::string& name) {
+    std::string quoted = "\"";
+    for(char c : name) {
+        if(c == '"') quoted += '"';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <array>
+#include <atomic>
+#include <thread>
+#include <type_traits>
+
+// Single writer, many readers. Readers never block the writer and always get
+// a consistent copy; they retry if a store happened while they were copying.
+// The payload is kept in atomic words so the racing copy is well defined.
+template<typename T>
+class Seqlock {
+    static_assert(std::is_trivially_copyable<T>::value, "payload is copied word by word");
+    static constexpr size_t WORDS = (sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+    std::atomic<uint32_t> sequence_{0}; // odd while a store is in progress
+    std::array<std::atomic<uint32_t>, WORDS> data_{};
+
+public:
+    Seqlock() { store(T{}); }
+
+    // Writer only
+    void store(const T& value) {
+        uint32_t words[WORDS] = {};
+        memcpy(words, &value, sizeof(T));
+
+        uint32_t seq = sequence_.load(std::memory_order_relaxed);
+        sequence_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for(size_t i = 0; i < WORDS; ++i)
+            data_[i].store(words[i], std::memory_order_relaxed);
+        sequence_.store(seq + 2, std::memory_order_release);
+    }
+
+    T load() const {
+        uint32_t words[WORDS];
+        for(;;) {
+            uint32_t before = sequence_.load(std::memory_order_acquire);
+            if(before & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            for(size_t i = 0; i < WORDS; ++i)
+                words[i] = data_[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(sequence_.load(std::memory_order_relaxed) == before) break;
+        }
+        T value;
+        memcpy(&value, words, sizeof(T));
+        return value;
+    }
+};
@@ -0,0 +1,198 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+// Index letter ("character" columns) and romanized sort string ("pinyin"
+// columns) for titles, albums and artists. Han readings come from a table
+// generated at build time (tools/pinyingen.cpp) indexed directly by code
+// point; kana and hangul are romanized from small tables here. Every lookup is
+// O(1) and nothing is loaded at runtime.
+
+#include "pinyin_data.h"
+
+// Next code point from UTF-8 at pos, advancing pos. Invalid bytes come back
+// as U+FFFD one at a time.
+inline uint32_t utf8_next(const char* s, size_t size, size_t& pos) {
+    unsigned char c = s[pos];
+    size_t len = c < 0x80 ? 1 : (c & 0xe0) == 0xc0 ? 2 : (c & 0xf0) == 0xe0 ? 3 : (c & 0xf8) == 0xf0 ? 4 : 0;
+    if(len == 0 || pos + len > size) {
+        pos += 1;
+        return 0xfffd;
+    }
+    uint32_t code = len == 1 ? c : len == 2 ? c & 0x1f : len == 3 ? c & 0x0f : c & 0x07;
+    for(size_t k = 1; k < len; ++k) {
+        unsigned char cont = s[pos + k];
+        if((cont & 0xc0) != 0x80) {
+            pos += 1;
+            return 0xfffd;
+        }
+        code = (code << 6) | (cont & 0x3f);
+    }
+    pos += len;
+    return code;
+}
+
+inline uint32_t utf8_next(const std::string& s, size_t& pos) {
+    return utf8_next(s.data(), s.size(), pos);
+}
+
+namespace sortkey_detail {
+
+// Base letters of Latin-1 (U+00C0..U+00FF) and Latin Extended-A
+// (U+0100..U+017F), '#' where there is none
+constexpr char LATIN_BASE[] =
+    "AAAAAAACEEEEIIIIDNOOOOO#OUUUUYTS" "AAAAAAACEEEEIIIIDNOOOOO#OUUUUYTY"
+    "AAAAAACCCCCCCCDDDDEEEEEEEEEEGGGGGGGGHHHHIIIIIIIIIIIIJJKKKLLLLLLLLLLNNNNNNNNNOOOOOOOO"
+    "RRRRRRSSSSSSSSTTTTTTUUUUUUUUUUUUWWYYYZZZZZZS";
+static_assert(sizeof(LATIN_BASE) - 1 == 0x180 - 0xc0, "one letter per code point");
+
+constexpr bool latin_lower(uint32_t code) {
+    return code < 0x100 ? code >= 0xdf
+        : code == 0x138 || code == 0x149 || code == 0x17f ? true
+        : code == 0x178 ? false
+        : (code >= 0x139 && code <= 0x148) || (code >= 0x179 && code <= 0x17e) ? code % 2 == 0
+        : code % 2 == 1;
+}
+
+// Hiragana U+3041..U+3096, katakana is the same 0x60 higher. Small kana are
+// marked with a leading '_' and combine with what comes before/after.
+constexpr const char* KANA[] = {
+    "_a", "a", "_i", "i", "_u", "u", "_e", "e", "_o", "o",
+    "ka", "ga", "ki", "gi", "ku", "gu", "ke", "ge", "ko", "go",
+    "sa", "za", "shi", "ji", "su", "zu", "se", "ze", "so", "zo",
+    "ta", "da", "chi", "ji", "_tsu", "tsu", "zu", "te", "de", "to", "do",
+    "na", "ni", "nu", "ne", "no",
+    "ha", "ba", "pa", "hi", "bi", "pi", "fu", "bu", "pu", "he", "be", "pe", "ho", "bo", "po",
+    "ma", "mi", "mu", "me", "mo",
+    "_ya", "ya", "_yu", "yu", "_yo", "yo",
+    "ra", "ri", "ru", "re", "ro",
+    "_wa", "wa", "i", "e", "o", "n", "vu", "ka", "ke",
+};
+static_assert(sizeof(KANA) / sizeof(KANA[0]) == 0x3096 - 0x3041 + 1, "one entry per kana");
+
+// Revised Romanization of hangul syllable parts
+constexpr const char* HANGUL_INITIAL[19] = {
+    "g", "kk", "n", "d", "tt", "r", "m", "b", "pp", "s", "ss", "", "j", "jj", "ch", "k", "t", "p", "h"};
+constexpr const char* HANGUL_VOWEL[21] = {
+    "a", "ae", "ya", "yae", "eo", "e", "yeo", "ye", "o", "wa", "wae", "oe", "yo", "u", "wo", "we", "wi", "yu",
+    "eu", "ui", "i"};
+constexpr const char* HANGUL_FINAL[28] = {
+    "", "k", "k", "k", "n", "n", "n", "t", "l", "k", "l", "l", "l", "l", "p", "l", "m", "p", "p", "t", "t",
+    "ng", "t", "t", "k", "t", "p", "t"};
+
+// How a code point was romanized
+enum class Script { Ascii, Word, Kana, None };
+
+// Appends the romanization of code to out, Script::None if there is none
+inline Script romanize_code(uint32_t code, std::string& out) {
+    if(code < 0x80) {
+        out += (char)code;
+        return Script::Ascii;
+    }
+    if(code >= 0xff01 && code <= 0xff5e) { // Full width ASCII
+        out += (char)(code - 0xfee0);
+        return Script::Ascii;
+    }
+    if(code >= 0xc0 && code < 0x180 && LATIN_BASE[code - 0xc0] != '#') {
+        char base = LATIN_BASE[code - 0xc0];
+        out += latin_lower(code) ? (char)(base - 'A' + 'a') : base;
+        return Script::Ascii;
+    }
+    if(code >= PINYIN_FIRST && code <= PINYIN_LAST && PINYIN_HAN[code - PINYIN_FIRST] != 0) {
+        out += PINYIN_SYLLABLES[PINYIN_HAN[code - PINYIN_FIRST]];
+        return Script::Word;
+    }
+    if(code >= 0x30a1 && code <= 0x30f6) code -= 0x60; // Katakana
+    if(code >= 0x3041 && code <= 0x3096) {
+        out += KANA[code - 0x3041];
+        return Script::Kana;
+    }
+    if(code >= 0xac00 && code <= 0xd7a3) {
+        uint32_t index = code - 0xac00;
+        out += HANGUL_INITIAL[index / 588];
+        out += HANGUL_VOWEL[index % 588 / 28];
+        out += HANGUL_FINAL[index % 28];
+        return Script::Word;
+    }
+    return Script::None;
+}
+
+} // namespace sortkey_detail
+
+// Romanized form for sorting: Han as toneless pinyin and hangul as Revised
+// Romanization, one word per syllable ("周杰伦" -> "zhou jie lun"), kana as
+// Hepburn romaji, accented Latin and full width letters folded to ASCII.
+// Anything else is kept as is. Appends to out, which can be any string type
+// (the importer passes arena strings, arena.h).
+template<typename Out>
+void romanize_into(const char* text, size_t size, Out& out) {
+    using namespace sortkey_detail;
+    out.reserve(out.size() + size);
+    bool word_end = false; // A pinyin/hangul syllable was just written
+    bool double_next = false; // After a small tsu
+    for(size_t pos = 0; pos < size;) {
+        size_t start = pos;
+        uint32_t code = utf8_next(text, size, pos);
+        if(code == 0x30fc) { // Long vowel mark repeats the vowel before it
+            if(!out.empty() && strchr("aiueo", out.back())) out += out.back();
+            continue;
+        }
+        std::string part;
+        Script script = romanize_code(code, part);
+        if(script == Script::None) {
+            part.assign(text + start, pos - start);
+        } else if(script == Script::Kana && part[0] == '_') {
+            // Small kana: tsu doubles the next consonant, ya/yu/yo merge
+            // into the syllable before ("ki" + "ya" -> "kya", "shi" + "ya" -> "sha")
+            part.erase(0, 1);
+            if(part == "tsu") {
+                double_next = true;
+                continue;
+            }
+            if(part[0] == 'y' && !out.empty() && out.back() == 'i') {
+                out.pop_back();
+                bool palatal = out.size() >= 2 && (out.compare(out.size() - 2, 2, "sh") == 0 || out.compare(out.size() - 2, 2, "ch") == 0);
+                if(palatal || (!out.empty() && out.back() == 'j')) part.erase(0, 1);
+                out.append(part.data(), part.size());
+                continue;
+            }
+        }
+        if(double_next && script == Script::Kana && !part.empty() && part[0] != 'a' && part[0] != 'i' &&
+                part[0] != 'u' && part[0] != 'e' && part[0] != 'o' && part[0] != 'n') {
+            out += part[0] == 'c' ? 't' : part[0];
+        }
+        double_next = false;
+
+        bool is_word = script == Script::Word;
+        if((is_word || word_end) && !out.empty() && out.back() != ' ' && part != " ")
+            out += ' ';
+        out.append(part.data(), part.size());
+        word_end = is_word;
+    }
+}
+
+inline std::string romanize(const std::string& text) {
+    std::string out;
+    romanize_into(text.data(), text.size(), out);
+    return out;
+}
+
+// Letter the firmware groups text under: 'A'-'Z' from the romanized first
+// character, '#' for digits, symbols and anything without a reading
+inline char index_letter(const char* text, size_t size) {
+    if(size == 0) return '#';
+    size_t pos = 0;
+    std::string part;
+    sortkey_detail::romanize_code(utf8_next(text, size, pos), part);
+    // Small kana are marked with a leading '_'
+    char c = part.empty() ? '#' : part[0] == '_' && part.size() > 1 ? part[1] : part[0];
+    if(c >= 'a' && c <= 'z') return c - 'a' + 'A';
+    if(c >= 'A' && c <= 'Z') return c;
+    return '#';
+}
+
+inline char index_letter(const std::string& text) {
+    return index_letter(text.data(), text.size());
+}
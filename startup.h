@@ -0,0 +1,92 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runs startup steps concurrently. Each step starts as soon as the steps it
+// depends on have finished; a failed step skips everything depending on it.
+class Startup {
+    enum class Status { Pending, Done, Failed };
+    struct Step {
+        std::string name;
+        std::vector<size_t> after;
+        std::function<bool()> fn;
+        Status status = Status::Pending;
+        std::chrono::steady_clock::time_point start{}, end{};
+    };
+
+    std::vector<Step> steps_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::chrono::steady_clock::time_point origin_;
+
+    void run_step(Step& step) {
+        bool deps_ok = true;
+        {
+            std::unique_lock<decltype(mutex_)> lock(mutex_);
+            for(size_t dep : step.after) {
+                while(steps_[dep].status == Status::Pending)
+                    condition_.wait(lock);
+                deps_ok = deps_ok && steps_[dep].status == Status::Done;
+            }
+        }
+
+        step.start = std::chrono::steady_clock::now();
+        bool ok = false;
+        try {
+            ok = deps_ok && step.fn();
+        } catch(const std::exception& e) {
+            std::cout << "startup: " << step.name << " threw " << e.what() << "\n";
+        }
+        step.end = std::chrono::steady_clock::now();
+
+        {
+            std::lock_guard<decltype(mutex_)> lock(mutex_);
+            step.status = ok ? Status::Done : Status::Failed;
+        }
+        condition_.notify_all();
+    }
+
+    static long ms(std::chrono::steady_clock::duration d) {
+        return (long)std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
+    }
+
+public:
+    explicit Startup(std::chrono::steady_clock::time_point origin) : origin_(origin) {}
+
+    // Steps named in after must have been added already
+    void add(const std::string& name, std::vector<std::string> after, std::function<bool()> fn) {
+        Step step;
+        step.name = name;
+        step.fn = std::move(fn);
+        for(auto& dep : after) {
+            for(size_t i = 0; i < steps_.size(); ++i)
+                if(steps_[i].name == dep) step.after.push_back(i);
+        }
+        steps_.push_back(std::move(step));
+    }
+
+    // Blocks until every step ran, logs per step timings. False if any failed.
+    bool run() {
+        std::vector<std::thread> threads;
+        for(auto& step : steps_)
+            threads.emplace_back([this, &step]{ run_step(step); });
+        for(auto& thread : threads)
+            thread.join();
+
+        bool ok = true;
+        for(auto& step : steps_) {
+            std::cout << "startup: " << step.name << " "
+                << (step.status == Status::Done ? "ok" : "FAILED")
+                << " at +" << ms(step.start - origin_) << "ms took " << ms(step.end - step.start) << "ms\n";
+            ok = ok && step.status == Status::Done;
+        }
+        return ok;
+    }
+};
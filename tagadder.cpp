@@ -1,10 +1,16 @@
 #include <iostream>
 #include <stdio.h>
-#include <fstream>
 
 #include <fileref.h>
 #include <tag.h>
 #include <tpropertymap.h>
+#include <flacfile.h>
+#include <mpegfile.h>
+#include <vorbisfile.h>
+#include <opusfile.h>
+#include <oggflacfile.h>
+#include <wavfile.h>
+#include <mp4file.h>
 
 extern "C" {
 #include <tfblib/tfblib.h>
@@ -14,12 +20,38 @@ extern "C" {
 
 #include <thread>
 #include <atomic>
-// Not in C++17
-#include "semaphore.h"
+#include <chrono>
+#include <memory>
+// Thread wakeups + queues
+#include "wakeup.h"
+#include "event_queue.h"
+#include "widgets.h"
+#include "progress.h"
+#include "seqlock.h"
+#include "input.h"
+#include "mapped_file.h"
+#include "atlas.h"
+#include "startup.h"
+#include "procctl.h"
+#include "jobs.h"
+#include "journal.h"
+#include "schema.h"
+#include "reconcile.h"
+#include "sortkey.h"
+#include "collation.h"
+#include "format.h"
+#include "arena.h"
+#include "rebuild.h"
+#include "indexes.h"
+#include "volume.h"
+#include "layout.h"
+#include "memgov.h"
+#include "power.h"
 
 #include <fcntl.h>
 #include <linux/input.h>
 #include <poll.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 
 #include <set>
@@ -32,38 +64,81 @@ namespace fs = std::experimental::filesystem; // gcc v7
 #include <ssfn.h>
 
 void render_thread();
-void touch_thread();
+void touch_thread(int fd);
 void parse_thread();
 void sqlite3_check_err(int code);
+bool write_sysfs(const char* path, const char* value);
+TagLib::File* open_track(const char* path, AudioFormat format, TagLib::AudioProperties::ReadStyle style);
 
 // Signals threads to start exiting
 std::atomic<bool> exit_thread(false);
 
-// Latest x/y
-std::atomic<uint32_t> input_x(0), input_y(0);
-
-// UI state
-std::atomic<uint32_t> state(0xff);
-
-// Holds current album/track
-std::string should_not_see = "[waiting]";
-std::atomic<std::string*> current_loading(&should_not_see);
-
-// Used to block on touch input
-// TODO drop inputs while loading/transitioning stuff
-Semaphore semaphore{};
-
-// Current directories to render
-std::string directories[5] = {};
-
-// ssfn v1 font binary data
-std::vector<std::string> font_binary{};
-
-// Not sure what official registration of codes is
-// https://www.recordingblogs.com/wiki/format-chunk-of-a-wave-file
-const std::map<std::string, int> FORMAT_IDS{
-    {".opus", 2373}, {".mp3", 85}, {".flac", 61686},
-    {".wav", 1}, {".ogg", 22127}, {".m4a", 278}};
+// For startup timings
+const auto process_start = std::chrono::steady_clock::now();
+
+#ifdef TAGADDER_COUNT_ALLOCS
+// Heap allocations made by the current thread (operator new at the bottom),
+// for the importer's allocations per track
+thread_local uint64_t heap_allocs = 0;
+#endif
+
+// Gestures from the touchscreen, in order, each handled once
+MpscQueue<Gesture, 16> input_queue{};
+Wakeup input_wakeup{};
+// Clock the touchscreen timestamps events with
+std::atomic<int> input_clock(CLOCK_REALTIME);
+
+// Everything the render thread draws, published as one consistent snapshot
+struct UiModel {
+    // UI state
+    uint32_t state = 0xff;
+    // Directory list position, rows come from directory_list
+    int32_t scroll = 0;
+    uint32_t list_version = 0;
+    // Directory shown on the confirm screen
+    char selected[128] = {};
+};
+Seqlock<UiModel> ui_model{};
+
+// Directories to choose from, replaced as a whole (bump list_version)
+std::shared_ptr<const std::vector<std::string>> directory_list = std::make_shared<std::vector<std::string>>();
+
+// Directory list geometry
+const int32_t LIST_TOP = 125, LIST_ROWS = 5, ROW_HEIGHT = 50;
+// Job list geometry on the jobs screen, tapping a row cancels that job
+const int32_t JOBS_TOP = 160, JOB_ROWS = 8, JOB_ROW_HEIGHT = 30;
+
+// Import progress, importer -> render thread
+ProgressChannel import_progress{};
+// Directories waiting to be imported, one at a time per card in the background
+ImportQueue import_jobs{};
+// Checkpoints of queued/running imports, survives a crash or power loss
+ImportJournal import_journal{"/data/tagadder.journal"};
+// Row cache, sqlite cache and import batch sizes, from what memory is free
+MemoryGovernor memory_governor{};
+// CPU boost (and the panel off, with --blank) while importing
+PowerSession power_session{};
+// Mounted cards, set up during startup and fixed after
+Volumes volumes{};
+
+// A track's tags and properties, read before the db is locked to write it
+struct ParsedTrack {
+    size_t file = 0; // Index in the import's file list
+    AudioFormat format = AudioFormat::Unknown;
+    std::string title, album, artist;
+    int year = 0, disc = 0, track_no = 0;
+    int size = 0, sample_rate = 0, bitrate = 0, channels = 0;
+    struct stat st{};
+};
+
+// Signalled whenever anything the render thread draws changes
+Wakeup ui_wakeup{};
+
+// Don't redraw more often than this, bursts of changes are coalesced
+const std::chrono::microseconds MIN_FRAME_INTERVAL(16666);
+
+// ssfn v1 fonts, mapped straight from the card
+std::vector<MappedFile> font_binary{};
 
 // SQL Queries
 const char* SQL_GET_MAX_ID = "SELECT MAX(id) FROM MEDIA_TABLE;";
@@ -88,303 +163,566 @@ const char* SQL_INSERT_ALBUM = "INSERT INTO ALBUM_TABLE VALUES(?, ?, ?, ?, ?, ?,
 const char* SQL_UPDATE_ALBUM = "UPDATE ALBUM_TABLE SET cn = ? WHERE album = ?;";
 const char* SQL_UPDATE_ALBUM2 = "UPDATE ALBUM2_TABLE SET cn = ? WHERE album = ?;";
 
-// Needs to be sorted (just albums)
-const char* SQL_FIX_ALBUM_SORT = "CREATE TABLE ALBUM_TEMP AS SELECT * FROM ALBUM_TABLE ORDER BY album COLLATE NOCASE ASC; DROP TABLE ALBUM_TABLE; ALTER TABLE ALBUM_TEMP RENAME TO ALBUM_TABLE; DROP TABLE ALBUM2_TABLE; CREATE TABLE ALBUM2_TABLE AS SELECT * FROM ALBUM_TABLE;";
+// Drop the rows listed in RECONCILE_GONE, then albums/artists left without tracks
+const char* SQL_RECONCILE_APPLY =
+    "UPDATE ALBUM_TABLE SET cn = cn - (SELECT COUNT(*) FROM temp.RECONCILE_GONE g WHERE g.album = ALBUM_TABLE.album) WHERE album IN (SELECT album FROM temp.RECONCILE_GONE);"
+    "UPDATE ALBUM2_TABLE SET cn = cn - (SELECT COUNT(*) FROM temp.RECONCILE_GONE g WHERE g.album = ALBUM2_TABLE.album) WHERE album IN (SELECT album FROM temp.RECONCILE_GONE);"
+    "UPDATE ARTIST_TABLE SET cn = cn - (SELECT COUNT(*) FROM temp.RECONCILE_GONE g WHERE g.artist = ARTIST_TABLE.artist) WHERE artist IN (SELECT artist FROM temp.RECONCILE_GONE);"
+    "UPDATE ARTIST2_TABLE SET cn = cn - (SELECT COUNT(*) FROM temp.RECONCILE_GONE g WHERE g.artist = ARTIST2_TABLE.artist) WHERE artist IN (SELECT artist FROM temp.RECONCILE_GONE);"
+    "DELETE FROM ALBUM_TABLE WHERE cn <= 0; DELETE FROM ALBUM2_TABLE WHERE cn <= 0;"
+    "DELETE FROM ARTIST_TABLE WHERE cn <= 0; DELETE FROM ARTIST2_TABLE WHERE cn <= 0;"
+    "DELETE FROM MEDIA_TABLE WHERE id IN (SELECT id FROM temp.RECONCILE_GONE);"
+    "DELETE FROM MEDIA2_TABLE WHERE id IN (SELECT id FROM temp.RECONCILE_GONE);";
+
+// Needs to be sorted (just albums), TAGKEY is registered on our connection
+const char* SQL_FIX_ALBUM_SORT = "CREATE TABLE ALBUM_TEMP AS SELECT * FROM ALBUM_TABLE ORDER BY album COLLATE TAGKEY ASC; DROP TABLE ALBUM_TABLE; ALTER TABLE ALBUM_TEMP RENAME TO ALBUM_TABLE; DROP TABLE ALBUM2_TABLE; CREATE TABLE ALBUM2_TABLE AS SELECT * FROM ALBUM_TABLE;";
 
 int main(int argc, char *argv[]) {
     // Help with logging in case of segfault/kill
     std::cout.setf(std::ios::unitbuf);
     std::cout << "Start\n";
 
-    // Load font(s)
-    const std::string fonts[] = {"/mnt/sd_0/font_cjk.sfn"};
-    for(auto& font_path : fonts) {
-        try {
-            std::ifstream font(font_path, std::ios::binary);
-            std::ostringstream font_data;
-            font_data << font.rdbuf();
-            font.close();
-            font_binary.push_back(font_data.str());
-        } catch (const std::ifstream::failure& e) {
-            std::cout << "no font " << font_path << "\n";
-            return -1;
-        }
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "--blank") == 0) power_session.set_blank(true);
     }
+    // A crashed run may have left the CPU boosted or the panel off
+    power_session.recover();
+    PowerSession::install_handlers();
+
+    // Main thread's copy of the UI, published to the render thread as a whole
+    UiModel model{};
+    auto publish = [&]{
+        ui_model.store(model);
+        ui_wakeup.notify();
+    };
+    model.state = 3; // Loading dirs
+    publish();
 
-    std::cout << "Fonts loaded: " << font_binary.size() << "\n";
-
-    // Kill native GUI and toggle power just in case
-    // TODO may still not work if touching/turned off while this is happening...?
-    system("kill `ps | grep 'hiby_player.sh' | head -n1 | awk '{print $1}'`");
-    system("kill `ps | grep 'system_main_thr' | head -n1 | awk '{print $1}'`");
-    usleep(200000);
-    system("echo 1 > /sys/class/graphics/fb0/blank");
-    usleep(200000);
-    system("echo 0 > /sys/class/graphics/fb0/blank");
-    usleep(200000);
-
-    // Set up sqlite3 connection
     sqlite3* db;
-    if(sqlite3_open_v2("/data/usrlocal_media.db", &db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK) {
-        std::cout << "Could not open db!\n";
-        return -1;
-    }
-
-    // Start threads
-    std::thread render(render_thread);
-    std::thread touch(touch_thread);
+    std::thread render, touch;
 
-    // Acquire initial directory list
     typedef struct {
         std::string path;
         time_t tv_sec;
     } direntry;
-    const fs::path home{"/mnt/sd_0/"};
     auto comparator = [](const direntry& a, const direntry& b) {
-        return a.tv_sec > b.tv_sec; // Order most recent first
+        if(a.tv_sec != b.tv_sec) return a.tv_sec > b.tv_sec; // Order most recent first
+        return a.path < b.path; // Don't drop directories with the same mtime
     };
     std::set<direntry, decltype(comparator)> entries{comparator};
-    struct stat stat_;
-    for(auto& entry : fs::directory_iterator{home}) {
-        // std::cout << "Discovered " << entry.path().u8string() << "\n";
-        if(!fs::is_directory(entry.status())) continue; // Directories only
-        stat(entry.path().u8string().c_str(), &stat_);
-        entries.insert(direntry{entry.path().u8string().substr(10), stat_.st_mtim.tv_sec});
+
+    // Independent steps run at the same time, see startup log for timings
+    Startup startup(process_start);
+
+    startup.add("fonts", {}, [&]{
+        // Map font(s), ssfn reads glyphs directly out of the mapping
+        const std::string fonts[] = {"/mnt/sd_0/font_cjk.sfn"};
+        for(auto& font_path : fonts) {
+            MappedFile font;
+            if(!font.open(font_path)) {
+                std::cout << "no font " << font_path << " - " << strerror(errno) << "\n";
+                return false;
+            }
+            font_binary.push_back(std::move(font));
+        }
+        std::cout << "Fonts loaded: " << font_binary.size() << ", RSS " << self_rss_kb() << "kB\n";
+        return true;
+    });
+
+    startup.add("scan", {}, [&]{
+        // Acquire initial directory list, from every card
+        volumes.load();
+        struct stat st;
+        for(const Volume& volume : volumes.all()) {
+            for(auto& entry : fs::directory_iterator{fs::path(volume.mount)}) {
+                // std::cout << "Discovered " << entry.path().u8string() << "\n";
+                if(!fs::is_directory(entry.status())) continue; // Directories only
+                stat(entry.path().u8string().c_str(), &st);
+                entries.insert(direntry{volumes.display(volume, entry.path().filename().u8string()), st.st_mtim.tv_sec});
+            }
+        }
+        std::cout << "Directory has [" << entries.size() << "] entries...\n";
+        return true;
+    });
+
+    // Set once the native GUI was stopped, a failed startup brings it back
+    std::atomic<bool> player_stopped(false);
+    // Not before the font is there, without it there'd be nothing to show.
+    // The db can only be opened once the player let go of it, so a failure
+    // there relaunches the player below.
+    startup.add("player", {"fonts"}, [&]{
+        // Kill native GUI and wait for it to actually be gone
+        player_stopped.store(true);
+        if(!ProcessControl::terminate({"hiby_player.sh", "system_main_thr"}, std::chrono::milliseconds(2000)))
+            std::cout << "Native GUI still running, continuing anyway\n";
+        return true;
+    });
+
+    startup.add("screen", {"player"}, [&]{
+        // Toggle power just in case; the writes return once the driver is done
+        // TODO may still not work if touching/turned off while this is happening...?
+        return write_sysfs("/sys/class/graphics/fb0/blank", "1") &&
+            write_sysfs("/sys/class/graphics/fb0/blank", "0");
+    });
+
+    startup.add("render", {"screen", "fonts"}, [&]{
+        render = std::thread(render_thread);
+        return true;
+    });
+
+    startup.add("touch", {"player"}, [&]{
+        auto fd = open("/dev/input/event2", O_RDONLY);
+        if(fd < 0) {
+            std::cout << "Can't open touchscreen " << strerror(errno) << "\n";
+            return true;
+        }
+        // Timestamp events with the monotonic clock so latency can be
+        // measured. Set before startup is over, the input cutoff is read in
+        // the same clock.
+        int clock = CLOCK_MONOTONIC;
+        if(ioctl(fd, EVIOCSCLOCKID, &clock) == 0)
+            input_clock.store(clock);
+        touch = std::thread(touch_thread, fd);
+        return true;
+    });
+
+    startup.add("db", {"player"}, [&]{
+        // Set up sqlite3 connection
+        if(sqlite3_open_v2("/data/usrlocal_media.db", &db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK) {
+            std::cout << "Could not open db!\n";
+            return false;
+        }
+        if(!register_tagkey_collation(db) || !register_sortkey_functions(db)) {
+            std::cout << "Could not register collation - " << sqlite3_errmsg(db) << "\n";
+            return false;
+        }
+        return true;
+    });
+
+    if(!startup.run()) {
+        exit_thread.store(true);
+        ui_wakeup.notify();
+        if(render.joinable()) render.join();
+        if(touch.joinable()) touch.join();
+        // Don't leave the device without a UI
+        if(player_stopped.load())
+            ProcessControl::spawn_detached({"/bin/sh", "/usr/bin/hiby_player.sh"});
+        return -1;
     }
-    std::cout << "Directory has [" << entries.size() << "] entries...";
-
-    // Set up current directory page
-    uint32_t page = 0;
-    uint32_t local_state = 0;
-    auto update_directory_strings = [&]{
-        std::cout << "Load page " << page << "\n";
-        local_state = 3; // Loading dirs
-        state.store(local_state);
-        auto it = entries.begin(); auto end = entries.begin();
-        if((page + 1) * 5 >= entries.size()) end = entries.end();
-        else std::advance(end, (page + 1) * 5);
-        std::advance(it, page * 5);
-        for(uint32_t i = 0; i < 5; ++i) {
-            if(it != entries.end()) {
-                directories[i] = (*it).path;
-                ++it;
-            } else
-                directories[i] = " - ";
-        }
-        usleep(16666*3); // wait for render (also debounce)
-        local_state = 0; // Ready
-        state.store(local_state);
+
+    // Importers take turns writing
+    std::mutex db_mutex;
+    // Only there while importing, a crashed run may have left them behind
+    SessionIndexes session_indexes(db);
+    session_indexes.drop();
+    // sqlite's page cache follows the memory budget, under db_mutex
+    int sqlite_cache_kb = 0;
+    auto apply_cache_size = [&](const MemoryBudget& budget) {
+        if(budget.sqlite_cache_kb == sqlite_cache_kb) return;
+        sqlite_cache_kb = budget.sqlite_cache_kb;
+        std::string pragma = "PRAGMA cache_size = -" + std::to_string(sqlite_cache_kb) + ";";
+        sqlite3_check_err(sqlite3_exec(db, pragma.c_str(), NULL, NULL, NULL));
+    };
+    apply_cache_size(memory_governor.update());
+
+    // Set up directory list
+    auto dirs = std::make_shared<std::vector<std::string>>();
+    dirs->reserve(entries.size());
+    for(auto& entry : entries) dirs->push_back(entry.path);
+    std::atomic_store(&directory_list, std::shared_ptr<const std::vector<std::string>>(dirs));
+    model.list_version += 1;
+    const int32_t max_scroll = std::max<int32_t>(0, (int32_t)dirs->size() * ROW_HEIGHT - LIST_ROWS * ROW_HEIGHT);
+    auto scroll_to = [&](int32_t scroll) {
+        model.scroll = std::min(std::max(scroll, 0), max_scroll);
+        publish();
     };
-    update_directory_strings();
+    model.state = 0; // Ready
 
     // Load songs from a directory
-    std::string current_copy = ""; // Keep alive reference
     sqlite3_stmt* stmt;
     int step_result;
-    auto load_songs = [&](uint32_t selected){
-        std::string base = "/mnt/sd_0/" + directories[selected];
+    // Names only, the file's first bytes decide later (format.h). Anything
+    // else TagLib has a parser for is taken too, it picks by extension.
+    std::vector<std::string> taglib_extensions;
+    for(auto& ext : TagLib::FileRef::defaultFileExtensions()) taglib_extensions.push_back(ext.to8Bit());
+    auto is_supported = [&](const fs::path& path) {
+        if(audio_extension(path.filename().c_str())) return true;
+        std::string ext = path.extension().u8string();
+        if(ext.empty()) return false;
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        return std::find(taglib_extensions.begin(), taglib_extensions.end(), ext.substr(1)) != taglib_extensions.end();
+    };
+    // Tags and properties of one file, read without the db. False if it
+    // isn't audio TagLib can read. Audio properties are TagLib's fast
+    // estimate, refine() corrects them afterwards where that can be off.
+    auto read_track = [](const std::string& path, ParsedTrack& out) {
+        // Picks the parser, and keeps TagLib away from anything that isn't audio
+        out.format = detect_file_format(path.c_str());
+        TagLib::FileRef track;
+        if(out.format == AudioFormat::Unknown && !audio_extension(path.c_str())) {
+            // No magic for it, TagLib goes by the extension
+            out.format = AudioFormat::Other;
+            track = TagLib::FileRef(path.c_str(), true, TagLib::AudioProperties::Fast);
+            if(track.isNull() || track.tag() == nullptr || track.audioProperties() == nullptr) return false;
+        } else {
+            TagLib::File* file = out.format == AudioFormat::Unknown ? nullptr
+                : open_track(path.c_str(), out.format, TagLib::AudioProperties::Fast);
+            if(file == nullptr || !file->isValid()) {
+                delete file;
+                return false;
+            }
+            track = TagLib::FileRef(file);
+        }
+        out.title = track.tag()->title().to8Bit(true);
+        out.album = track.tag()->album().to8Bit(true);
+        out.artist = track.tag()->artist().to8Bit(true);
+        out.year = track.tag()->year();
+        auto tags = track.tag()->properties().value("DISCNUMBER");
+        out.disc = tags.size() > 0 ? std::stoi(tags[0].toCString()) : 0;
+        out.track_no = track.tag()->track();
+        out.size = track.file()->length();
+        out.sample_rate = track.audioProperties()->sampleRate();
+        out.bitrate = track.audioProperties()->bitrate();
+        out.channels = track.audioProperties()->channels();
+        stat(path.c_str(), &out.st);
+        return true;
+    };
+    // Import one job's directory, stopping early if it gets cancelled. Tags
+    // are read a batch at a time without holding the db, so the importer of
+    // another card reads in parallel; each batch is then written in one
+    // transaction.
+    auto load_songs = [&](const ImportJob& job){
+        std::string relative;
+        const Volume* volume = volumes.resolve(job.directory, relative);
+        if(volume == nullptr)
+            throw std::runtime_error("its volume isn't mounted");
+        std::string base = volume->mount + relative;
         std::cout << "Updating " << base << "\n";
-
-        // Get start target media ID
-        sqlite3_check_err(sqlite3_prepare_v2(db, SQL_GET_MAX_ID, strlen(SQL_GET_MAX_ID), &stmt, NULL));
-        sqlite3_check_err(sqlite3_step(stmt));
-        int newId = sqlite3_column_int(stmt, 0);
-        sqlite3_check_err(sqlite3_finalize(stmt));
-        std::cout << "start ID is " << newId << "\n";
-
-        for(auto& entry : fs::directory_iterator{base}) {
-            std::cout << "Reading " << entry.path().u8string() << "\n";
-            // std::cout << "ext = " << entry.path().extension().string() << "\n";
-            // Check supported filetype
-            if(!TagLib::FileRef::defaultFileExtensions()
-                    .contains(entry.path().extension().string().substr(1))) continue;
-
-            newId += 1;
-            TagLib::FileRef track(entry.path().u8string().c_str());
-            current_copy = track.tag()->title().to8Bit(true);
-            std::cout << "Title: " << current_copy << "\n";
-            current_loading.store(&current_copy);
-
-            // Start DB update (disaster below)
-            ////////////////////////////
-            stat(entry.path().u8string().c_str(), &stat_);
-
-            ////////// Media
-
-            std::cout << "media" << "\n";
-            auto update_media = [&](const char* query) {
-            sqlite3_check_err(sqlite3_prepare_v2(db, query, strlen(query), &stmt, NULL));
-            sqlite3_check_err(sqlite3_bind_int(stmt, 1, newId)); // ID
-            std::string pathWithA = "a:/" + entry.path().u8string().substr(10);
-            std::replace(pathWithA.begin(), pathWithA.end(), '/', '\\');
-            sqlite3_check_err(sqlite3_bind_text(stmt, 2, pathWithA.data(), pathWithA.size() + 1, SQLITE_TRANSIENT)); // Path
-            // TODO don't update if path already in db
-            sqlite3_check_err(sqlite3_bind_text(stmt, 3, current_copy.data(), current_copy.size() + 1, SQLITE_TRANSIENT)); // Name
-            sqlite3_check_err(sqlite3_bind_text(stmt, 4,
-                        track.tag()->album().to8Bit(true).data(),
-                        track.tag()->album().to8Bit(true).size() + 1,
-                        SQLITE_TRANSIENT)); // Album
-            sqlite3_check_err(sqlite3_bind_text(stmt, 5,
-                        track.tag()->artist().to8Bit(true).data(),
-                        track.tag()->artist().to8Bit(true).size() + 1,
-                        SQLITE_TRANSIENT)); // Artist
-            sqlite3_check_err(sqlite3_bind_int(stmt, 6, track.tag()->year())); // year
-            auto tags = track.tag()->properties().value("DISCNUMBER");
-            if(tags.size() > 0)
-                sqlite3_check_err(sqlite3_bind_int(stmt, 7, std::stoi(tags[0].toCString()))); // disc
-            else
-                sqlite3_check_err(sqlite3_bind_int(stmt, 7, 0)); // disc
-            sqlite3_check_err(sqlite3_bind_int(stmt, 8, track.tag()->track())); // trackno
-            sqlite3_check_err(sqlite3_bind_text(stmt, 9, current_copy.data(), 1, SQLITE_TRANSIENT)); // character TODO properly cut unicode
-            sqlite3_check_err(sqlite3_bind_int(stmt, 10, track.file()->length())); // size in bytes
-            sqlite3_check_err(sqlite3_bind_int(stmt, 11, track.audioProperties()->sampleRate())); // Hz
-            sqlite3_check_err(sqlite3_bind_int(stmt, 12, track.audioProperties()->bitrate())); // bitrate
-            sqlite3_check_err(sqlite3_bind_int(stmt, 13, track.audioProperties()->channels())); // channels
-            if(FORMAT_IDS.count(entry.path().extension().string()))
-                sqlite3_check_err(sqlite3_bind_int(stmt, 14, FORMAT_IDS.at(entry.path().extension().string()))); // ID
-            else
-                sqlite3_check_err(sqlite3_bind_int(stmt, 14, 0)); // ID
-            sqlite3_check_err(sqlite3_bind_int(stmt, 15, stat_.st_ctim.tv_sec)); // create
-            sqlite3_check_err(sqlite3_bind_int(stmt, 16, stat_.st_mtim.tv_sec)); // modified
-            sqlite3_check_err(sqlite3_bind_text(stmt, 17, current_copy.data(), current_copy.size() + 1, SQLITE_TRANSIENT)); // Name again (pinyin)
-            sqlite3_check_err(sqlite3_step(stmt));
-            sqlite3_check_err(sqlite3_finalize(stmt));
-            };
-            update_media(SQL_INSERT_MEDIA);
-            update_media(SQL_INSERT_MEDIA2);
-
-            ////////// Album
-            std::cout << "album" << "\n";
-            sqlite3_check_err(sqlite3_prepare_v2(db, SQL_CHECK_ALBUM, strlen(SQL_CHECK_ALBUM), &stmt, NULL));
-            sqlite3_check_err(sqlite3_bind_text(stmt, 1,
-                        track.tag()->album().to8Bit(true).data(),
-                        track.tag()->album().to8Bit(true).size() + 1,
-                        SQLITE_TRANSIENT)); // Album
-            step_result = sqlite3_step(stmt);
-            sqlite3_finalize(stmt);
-            if(step_result == SQLITE_ROW) { // Exists
-                // Add count
-                int cn = sqlite3_column_int(stmt, 0) + 1;
-                sqlite3_check_err(sqlite3_finalize(stmt));
-
-                sqlite3_check_err(sqlite3_prepare_v2(db, SQL_UPDATE_ALBUM, strlen(SQL_UPDATE_ALBUM), &stmt, NULL));
-                sqlite3_check_err(sqlite3_bind_int(stmt, 1, cn));
-                sqlite3_check_err(sqlite3_bind_text(stmt, 2,
-                            track.tag()->album().to8Bit(true).data(),
-                            track.tag()->album().to8Bit(true).size() + 1,
-                            SQLITE_TRANSIENT)); // Album
-                sqlite3_check_err(sqlite3_step(stmt));
-                sqlite3_check_err(sqlite3_finalize(stmt));
-
-                sqlite3_check_err(sqlite3_prepare_v2(db, SQL_UPDATE_ALBUM2, strlen(SQL_UPDATE_ALBUM2), &stmt, NULL));
-                sqlite3_check_err(sqlite3_bind_int(stmt, 1, cn));
-                sqlite3_check_err(sqlite3_bind_text(stmt, 2,
-                            track.tag()->album().to8Bit(true).data(),
-                            track.tag()->album().to8Bit(true).size() + 1,
-                            SQLITE_TRANSIENT)); // Album
-                sqlite3_check_err(sqlite3_step(stmt));
-                sqlite3_check_err(sqlite3_finalize(stmt));
+        // Per-track strings, reused batch after batch
+        Arena import_arena;
+        ArenaAllocator<char> arena_alloc(import_arena);
+#ifdef TAGADDER_COUNT_ALLOCS
+        uint64_t allocs_start = heap_allocs;
+#endif
+        uint32_t imported = 0;
+        // Time spent finding existing paths/albums/artists
+        std::chrono::steady_clock::duration lookup_time{};
+        uint32_t looked_up = 0;
+
+        // Cheap listing (names only) so progress has a total. Read in the
+        // order the files lie on the card, which is also the same order when
+        // a resumed import lists them again.
+        std::vector<std::string> files;
+        for(auto& entry : fs::directory_iterator{base})
+            if(is_supported(entry.path())) files.push_back(entry.path().u8string());
+        std::sort(files.begin(), files.end());
+        LayoutStats layout = order_by_layout(files);
+        std::cout << "Layout order: " << layout.fiemap << " by extent, " << layout.fibmap << " by block, "
+            << layout.inode << " by inode, " << layout.failed << " unknown\n";
+
+        // Carry on after the last committed file of an interrupted run
+        JournalEntry checkpoint;
+        size_t next = 0;
+        uint32_t done = 0;
+        if(import_journal.checkpoint(job.directory, checkpoint) && !checkpoint.last_path.empty()) {
+            auto last = std::find(files.begin(), files.end(), checkpoint.last_path);
+            if(last != files.end()) {
+                next = last - files.begin() + 1;
+                done = checkpoint.files_done;
+                std::cout << "Resuming after " << checkpoint.last_path << " (" << done << " tracks done)\n";
             } else {
-                // New album
-                auto update_new_album = [&](const char* query) {
-                sqlite3_check_err(sqlite3_prepare_v2(db, query, strlen(query), &stmt, NULL));
-                sqlite3_check_err(sqlite3_bind_int(stmt, 1, newId)); // ID
-                sqlite3_check_err(sqlite3_bind_text(stmt, 2,
-                            track.tag()->album().to8Bit(true).data(),
-                            track.tag()->album().to8Bit(true).size() + 1,
-                            SQLITE_TRANSIENT)); // Album
-                sqlite3_check_err(sqlite3_bind_text(stmt, 3,
-                            track.tag()->album().to8Bit(true).data(),
-                            1,
-                            SQLITE_TRANSIENT)); // Character
-                sqlite3_check_err(sqlite3_bind_int(stmt, 4, 1)); // tracks
-                sqlite3_check_err(sqlite3_bind_int(stmt, 5, stat_.st_ctim.tv_sec)); // create
-                sqlite3_check_err(sqlite3_bind_int(stmt, 6, stat_.st_mtim.tv_sec)); // modified
-                sqlite3_check_err(sqlite3_bind_text(stmt, 7,
-                            track.tag()->album().to8Bit(true).data(),
-                            track.tag()->album().to8Bit(true).size() + 1,
-                            SQLITE_TRANSIENT)); // Pinyin copy
-                sqlite3_check_err(sqlite3_step(stmt));
-                sqlite3_check_err(sqlite3_finalize(stmt));
-                };
-                update_new_album(SQL_INSERT_ALBUM);
-                // update_new_album(SQL_INSERT_ALBUM2);
-
-                // Instead we need to just fix(resort) current tables here
-                char* errmsg = NULL;
-                sqlite3_exec(db, SQL_FIX_ALBUM_SORT, NULL, NULL, &errmsg);
-                if(errmsg != NULL) {
-                    std::cout << "Failed to fix album sort - " << errmsg << "\n";
-                    free(errmsg);
+                // Gone since, start over; what was imported is skipped as known
+                std::cout << "Checkpoint " << checkpoint.last_path << " is gone, checking every file again\n";
+            }
+        }
+        uint32_t total = done + (files.size() - next);
+        std::string check_path;
+        {
+            std::lock_guard<std::mutex> lock(db_mutex);
+            import_progress.begin(files.size() - next);
+            // Rows from earlier imports have the path with or without its NUL
+            check_path = "SELECT 1 FROM MEDIA_TABLE WHERE " + quote_name(column_name(db, "MEDIA_TABLE", 1)) + " IN (?, ?) LIMIT 1;";
+        }
+        // finish() whichever way this returns. Producers take turns through
+        // db_mutex, but waiting for the render thread to drain happens
+        // without it (it may be gone if the framebuffer couldn't be acquired).
+        struct ProgressEnd {
+            std::mutex& mutex;
+            ~ProgressEnd() {
+                bool delivered;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    delivered = import_progress.finish();
+                }
+                ui_wakeup.notify();
+                for(int tries = 0; !delivered && tries < 10; ++tries) {
+                    std::this_thread::sleep_for(ProgressChannel::retry_interval());
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        delivered = import_progress.deliver_pending();
+                    }
+                    ui_wakeup.notify();
                 }
             }
-
-            ////////// Artist
-            std::cout << "artist" << "\n";
-            sqlite3_check_err(sqlite3_prepare_v2(db, SQL_CHECK_ARTIST, strlen(SQL_CHECK_ARTIST), &stmt, NULL));
-            sqlite3_check_err(sqlite3_bind_text(stmt, 1,
-                        track.tag()->artist().to8Bit(true).data(),
-                        track.tag()->artist().to8Bit(true).size() + 1,
-                        SQLITE_TRANSIENT)); // Artist
-            step_result = sqlite3_step(stmt);
-            sqlite3_finalize(stmt);
-            if(step_result == SQLITE_ROW) { // Exists
-                // Add count
-                int cn = sqlite3_column_int(stmt, 0) + 1;
-                sqlite3_check_err(sqlite3_finalize(stmt));
-
-                sqlite3_check_err(sqlite3_prepare_v2(db, SQL_UPDATE_ARTIST, strlen(SQL_UPDATE_ARTIST), &stmt, NULL));
-                sqlite3_check_err(sqlite3_bind_int(stmt, 1, cn));
-                sqlite3_check_err(sqlite3_bind_text(stmt, 2,
-                            track.tag()->artist().to8Bit(true).data(),
-                            track.tag()->artist().to8Bit(true).size() + 1,
-                            SQLITE_TRANSIENT)); // Artist
-                sqlite3_check_err(sqlite3_step(stmt));
-                sqlite3_check_err(sqlite3_finalize(stmt));
-
-                sqlite3_check_err(sqlite3_prepare_v2(db, SQL_UPDATE_ARTIST2, strlen(SQL_UPDATE_ARTIST), &stmt, NULL));
-                sqlite3_check_err(sqlite3_bind_int(stmt, 1, cn));
-                sqlite3_check_err(sqlite3_bind_text(stmt, 2,
-                            track.tag()->artist().to8Bit(true).data(),
-                            track.tag()->artist().to8Bit(true).size() + 1,
-                            SQLITE_TRANSIENT)); // Artist
-                sqlite3_check_err(sqlite3_step(stmt));
-                sqlite3_check_err(sqlite3_finalize(stmt));
-            } else {
-                // New artist
-                auto update_new_artist = [&](const char* query) {
-                sqlite3_check_err(sqlite3_prepare_v2(db, query, strlen(query), &stmt, NULL));
-                sqlite3_check_err(sqlite3_bind_int(stmt, 1, newId)); // ID
-                sqlite3_check_err(sqlite3_bind_text(stmt, 2,
-                            track.tag()->artist().to8Bit(true).data(),
-                            track.tag()->artist().to8Bit(true).size() + 1,
-                            SQLITE_TRANSIENT)); // Artist
-                sqlite3_check_err(sqlite3_bind_text(stmt, 3,
-                            track.tag()->artist().to8Bit(true).data(),
-                            1,
-                            SQLITE_TRANSIENT)); // Character
-                sqlite3_check_err(sqlite3_bind_int(stmt, 4, 1)); // tracks
-                sqlite3_check_err(sqlite3_bind_int(stmt, 5, stat_.st_ctim.tv_sec)); // create
-                sqlite3_check_err(sqlite3_bind_int(stmt, 6, stat_.st_mtim.tv_sec)); // modified
-                sqlite3_check_err(sqlite3_bind_text(stmt, 7,
-                            track.tag()->artist().to8Bit(true).data(),
-                            track.tag()->artist().to8Bit(true).size() + 1,
-                            SQLITE_TRANSIENT)); // Pinyin copy
-                sqlite3_check_err(sqlite3_step(stmt));
-                sqlite3_check_err(sqlite3_finalize(stmt));
-                };
-                update_new_artist(SQL_INSERT_ARTIST);
-                update_new_artist(SQL_INSERT_ARTIST2);
+        } progress_end{db_mutex};
+        import_jobs.progress(job.id, done, total);
+        ui_wakeup.notify();
+
+        auto path_known = [&](const char* path, size_t size) {
+            sqlite3_check_err(sqlite3_prepare_v2(db, check_path.c_str(), check_path.size(), &stmt, NULL));
+            sqlite3_check_err(sqlite3_bind_text(stmt, 1, path, size + 1, SQLITE_STATIC));
+            sqlite3_check_err(sqlite3_bind_text(stmt, 2, path, size, SQLITE_STATIC));
+            bool known = sqlite3_step(stmt) == SQLITE_ROW;
+            sqlite3_check_err(sqlite3_finalize(stmt));
+            return known;
+        };
+        auto db_path = [&](const std::string& path) {
+            ArenaString key(arena_alloc);
+            volume->db_path(path, key);
+            return key;
+        };
+
+        std::vector<ParsedTrack> parsed;
+        std::vector<char> known;
+        bool cancelled = false;
+        bool needs_refine = false; // Read a format whose fast properties are estimates
+        for(size_t start = next; start < files.size() && !cancelled;) {
+            // Batches (tracks held parsed at once) shrink when memory is tight
+            MemoryBudget budget = memory_governor.update();
+            size_t end = std::min(files.size(), start + budget.batch);
+            // Nothing from the last batch's tracks is alive any more
+            import_arena.reset();
+
+            // Imported before, or by a batch redone after a crash
+            known.assign(end - start, 0);
+            {
+                std::lock_guard<std::mutex> lock(db_mutex);
+                auto lookup_start = std::chrono::steady_clock::now();
+                for(size_t i = start; i < end; ++i) {
+                    ArenaString key = db_path(files[i]);
+                    known[i - start] = path_known(key.data(), key.size());
+                }
+                lookup_time += std::chrono::steady_clock::now() - lookup_start;
+                looked_up += end - start;
             }
 
-            ////////// Mtime
-            std::cout << "mtime" << "\n";
-            sqlite3_check_err(sqlite3_prepare_v2(db, SQL_INSERT_MTIME, strlen(SQL_INSERT_MTIME), &stmt, NULL));
-            sqlite3_check_err(sqlite3_bind_int(stmt, 1, newId));
+            // The slow part, card I/O and parsing
+            parsed.clear();
+            size_t stop = end; // First file left for later when cancelled
+            {
+                // Waits for another importer's batch while memory is tight
+                memory_governor.begin_parse();
+                struct ParseEnd { ~ParseEnd() { memory_governor.end_parse(); } } parse_end;
+                for(size_t i = start; i < end; ++i) {
+                    if(!import_jobs.progress(job.id, done + (i - start), total)) {
+                        cancelled = true;
+                        stop = i;
+                        break;
+                    }
+                    std::cout << "Reading " << files[i] << "\n";
+                    if(known[i - start]) {
+                        std::cout << "Already in db\n";
+                        continue;
+                    }
+                    ParsedTrack track;
+                    if(!read_track(files[i], track)) {
+                        std::cout << "Not an audio file we can read, skipping\n";
+                        continue;
+                    }
+                    track.file = i;
+                    needs_refine = needs_refine || track.format == AudioFormat::Mpeg || track.format == AudioFormat::Mp4;
+                    std::cout << "Title: " << track.title << "\n";
+                    parsed.push_back(std::move(track));
+                }
+            }
+            if(stop == start) break;
+
+            // One transaction per batch, checkpointed around the commit
+            std::lock_guard<std::mutex> lock(db_mutex);
+            apply_cache_size(budget);
+            // Files already in the db or unreadable count towards the bar too
+            if(import_progress.files_skipped((uint32_t)(stop - start - parsed.size())))
+                ui_wakeup.notify();
+            // Get start target media ID, the other importer may have added rows
+            sqlite3_check_err(sqlite3_prepare_v2(db, SQL_GET_MAX_ID, strlen(SQL_GET_MAX_ID), &stmt, NULL));
             sqlite3_check_err(sqlite3_step(stmt));
+            int newId = sqlite3_column_int(stmt, 0);
             sqlite3_check_err(sqlite3_finalize(stmt));
-            ////////////////////////////
+            import_journal.begin_batch(job.directory, newId + 1, newId + (int)parsed.size(), stop - start, files[stop - 1]);
+            sqlite3_check_err(sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL));
+            try {
+                bool albums_added = false;
+                for(ParsedTrack& track : parsed) {
+                    newId += 1;
+                    imported += 1;
+                    ArenaString pathWithA = db_path(files[track.file]);
+
+                    // Start DB update (disaster below)
+                    ////////////////////////////
+
+                    ////////// Media
+
+                    std::cout << "media" << "\n";
+                    auto update_media = [&](const char* query) {
+                    sqlite3_check_err(sqlite3_prepare_v2(db, query, strlen(query), &stmt, NULL));
+                    sqlite3_check_err(sqlite3_bind_int(stmt, 1, newId)); // ID
+                    sqlite3_check_err(sqlite3_bind_text(stmt, 2, pathWithA.data(), pathWithA.size() + 1, SQLITE_STATIC)); // Path
+                    sqlite3_check_err(sqlite3_bind_text(stmt, 3, track.title.data(), track.title.size() + 1, SQLITE_STATIC)); // Name
+                    sqlite3_check_err(sqlite3_bind_text(stmt, 4, track.album.data(), track.album.size() + 1, SQLITE_STATIC)); // Album
+                    sqlite3_check_err(sqlite3_bind_text(stmt, 5, track.artist.data(), track.artist.size() + 1, SQLITE_STATIC)); // Artist
+                    sqlite3_check_err(sqlite3_bind_int(stmt, 6, track.year)); // year
+                    sqlite3_check_err(sqlite3_bind_int(stmt, 7, track.disc)); // disc
+                    sqlite3_check_err(sqlite3_bind_int(stmt, 8, track.track_no)); // trackno
+                    const char title_letter = index_letter(track.title);
+                    sqlite3_check_err(sqlite3_bind_text(stmt, 9, &title_letter, 1, SQLITE_STATIC)); // character
+                    sqlite3_check_err(sqlite3_bind_int(stmt, 10, track.size)); // size in bytes
+                    sqlite3_check_err(sqlite3_bind_int(stmt, 11, track.sample_rate)); // Hz
+                    sqlite3_check_err(sqlite3_bind_int(stmt, 12, track.bitrate)); // bitrate
+                    sqlite3_check_err(sqlite3_bind_int(stmt, 13, track.channels)); // channels
+                    sqlite3_check_err(sqlite3_bind_int(stmt, 14, format_id(track.format))); // ID
+                    sqlite3_check_err(sqlite3_bind_int(stmt, 15, track.st.st_ctim.tv_sec)); // create
+                    sqlite3_check_err(sqlite3_bind_int(stmt, 16, track.st.st_mtim.tv_sec)); // modified
+                    ArenaString title_key(arena_alloc);
+                    romanize_into(track.title.data(), track.title.size(), title_key);
+                    sqlite3_check_err(sqlite3_bind_text(stmt, 17, title_key.data(), title_key.size() + 1, SQLITE_STATIC)); // pinyin
+                    sqlite3_check_err(sqlite3_step(stmt));
+                    sqlite3_check_err(sqlite3_finalize(stmt));
+                    };
+                    update_media(SQL_INSERT_MEDIA);
+                    update_media(SQL_INSERT_MEDIA2);
+
+                    ////////// Album
+                    std::cout << "album" << "\n";
+                    auto lookup_start = std::chrono::steady_clock::now();
+                    sqlite3_check_err(sqlite3_prepare_v2(db, SQL_CHECK_ALBUM, strlen(SQL_CHECK_ALBUM), &stmt, NULL));
+                    sqlite3_check_err(sqlite3_bind_text(stmt, 1, track.album.data(), track.album.size() + 1, SQLITE_STATIC)); // Album
+                    step_result = sqlite3_step(stmt);
+                    lookup_time += std::chrono::steady_clock::now() - lookup_start;
+                    sqlite3_finalize(stmt);
+                    if(step_result == SQLITE_ROW) { // Exists
+                        // Add count
+                        int cn = sqlite3_column_int(stmt, 0) + 1;
+                        sqlite3_check_err(sqlite3_finalize(stmt));
+
+                        sqlite3_check_err(sqlite3_prepare_v2(db, SQL_UPDATE_ALBUM, strlen(SQL_UPDATE_ALBUM), &stmt, NULL));
+                        sqlite3_check_err(sqlite3_bind_int(stmt, 1, cn));
+                        sqlite3_check_err(sqlite3_bind_text(stmt, 2, track.album.data(), track.album.size() + 1, SQLITE_STATIC)); // Album
+                        sqlite3_check_err(sqlite3_step(stmt));
+                        sqlite3_check_err(sqlite3_finalize(stmt));
+
+                        sqlite3_check_err(sqlite3_prepare_v2(db, SQL_UPDATE_ALBUM2, strlen(SQL_UPDATE_ALBUM2), &stmt, NULL));
+                        sqlite3_check_err(sqlite3_bind_int(stmt, 1, cn));
+                        sqlite3_check_err(sqlite3_bind_text(stmt, 2, track.album.data(), track.album.size() + 1, SQLITE_STATIC)); // Album
+                        sqlite3_check_err(sqlite3_step(stmt));
+                        sqlite3_check_err(sqlite3_finalize(stmt));
+                    } else {
+                        // New album
+                        auto update_new_album = [&](const char* query) {
+                        sqlite3_check_err(sqlite3_prepare_v2(db, query, strlen(query), &stmt, NULL));
+                        sqlite3_check_err(sqlite3_bind_int(stmt, 1, newId)); // ID
+                        sqlite3_check_err(sqlite3_bind_text(stmt, 2, track.album.data(), track.album.size() + 1, SQLITE_STATIC)); // Album
+                        const char album_letter = index_letter(track.album.data(), track.album.size());
+                        sqlite3_check_err(sqlite3_bind_text(stmt, 3, &album_letter, 1, SQLITE_STATIC)); // Character
+                        sqlite3_check_err(sqlite3_bind_int(stmt, 4, 1)); // tracks
+                        sqlite3_check_err(sqlite3_bind_int(stmt, 5, track.st.st_ctim.tv_sec)); // create
+                        sqlite3_check_err(sqlite3_bind_int(stmt, 6, track.st.st_mtim.tv_sec)); // modified
+                        ArenaString album_key(arena_alloc);
+                        romanize_into(track.album.data(), track.album.size(), album_key);
+                        sqlite3_check_err(sqlite3_bind_text(stmt, 7, album_key.data(), album_key.size() + 1, SQLITE_STATIC)); // Pinyin
+                        sqlite3_check_err(sqlite3_step(stmt));
+                        sqlite3_check_err(sqlite3_finalize(stmt));
+                        };
+                        update_new_album(SQL_INSERT_ALBUM);
+                        // update_new_album(SQL_INSERT_ALBUM2);
+
+                        // Instead we need to just fix(resort) current tables, once
+                        // per batch before it commits
+                        albums_added = true;
+                    }
+
+                    ////////// Artist
+                    std::cout << "artist" << "\n";
+                    lookup_start = std::chrono::steady_clock::now();
+                    sqlite3_check_err(sqlite3_prepare_v2(db, SQL_CHECK_ARTIST, strlen(SQL_CHECK_ARTIST), &stmt, NULL));
+                    sqlite3_check_err(sqlite3_bind_text(stmt, 1, track.artist.data(), track.artist.size() + 1, SQLITE_STATIC)); // Artist
+                    step_result = sqlite3_step(stmt);
+                    lookup_time += std::chrono::steady_clock::now() - lookup_start;
+                    sqlite3_finalize(stmt);
+                    if(step_result == SQLITE_ROW) { // Exists
+                        // Add count
+                        int cn = sqlite3_column_int(stmt, 0) + 1;
+                        sqlite3_check_err(sqlite3_finalize(stmt));
+
+                        sqlite3_check_err(sqlite3_prepare_v2(db, SQL_UPDATE_ARTIST, strlen(SQL_UPDATE_ARTIST), &stmt, NULL));
+                        sqlite3_check_err(sqlite3_bind_int(stmt, 1, cn));
+                        sqlite3_check_err(sqlite3_bind_text(stmt, 2, track.artist.data(), track.artist.size() + 1, SQLITE_STATIC)); // Artist
+                        sqlite3_check_err(sqlite3_step(stmt));
+                        sqlite3_check_err(sqlite3_finalize(stmt));
+
+                        sqlite3_check_err(sqlite3_prepare_v2(db, SQL_UPDATE_ARTIST2, strlen(SQL_UPDATE_ARTIST), &stmt, NULL));
+                        sqlite3_check_err(sqlite3_bind_int(stmt, 1, cn));
+                        sqlite3_check_err(sqlite3_bind_text(stmt, 2, track.artist.data(), track.artist.size() + 1, SQLITE_STATIC)); // Artist
+                        sqlite3_check_err(sqlite3_step(stmt));
+                        sqlite3_check_err(sqlite3_finalize(stmt));
+                    } else {
+                        // New artist
+                        auto update_new_artist = [&](const char* query) {
+                        sqlite3_check_err(sqlite3_prepare_v2(db, query, strlen(query), &stmt, NULL));
+                        sqlite3_check_err(sqlite3_bind_int(stmt, 1, newId)); // ID
+                        sqlite3_check_err(sqlite3_bind_text(stmt, 2, track.artist.data(), track.artist.size() + 1, SQLITE_STATIC)); // Artist
+                        const char artist_letter = index_letter(track.artist.data(), track.artist.size());
+                        sqlite3_check_err(sqlite3_bind_text(stmt, 3, &artist_letter, 1, SQLITE_STATIC)); // Character
+                        sqlite3_check_err(sqlite3_bind_int(stmt, 4, 1)); // tracks
+                        sqlite3_check_err(sqlite3_bind_int(stmt, 5, track.st.st_ctim.tv_sec)); // create
+                        sqlite3_check_err(sqlite3_bind_int(stmt, 6, track.st.st_mtim.tv_sec)); // modified
+                        ArenaString artist_key(arena_alloc);
+                        romanize_into(track.artist.data(), track.artist.size(), artist_key);
+                        sqlite3_check_err(sqlite3_bind_text(stmt, 7, artist_key.data(), artist_key.size() + 1, SQLITE_STATIC)); // Pinyin
+                        sqlite3_check_err(sqlite3_step(stmt));
+                        sqlite3_check_err(sqlite3_finalize(stmt));
+                        };
+                        update_new_artist(SQL_INSERT_ARTIST);
+                        update_new_artist(SQL_INSERT_ARTIST2);
+                    }
+
+                    ////////// Mtime
+                    std::cout << "mtime" << "\n";
+                    sqlite3_check_err(sqlite3_prepare_v2(db, SQL_INSERT_MTIME, strlen(SQL_INSERT_MTIME), &stmt, NULL));
+                    sqlite3_check_err(sqlite3_bind_int(stmt, 1, newId));
+                    sqlite3_check_err(sqlite3_step(stmt));
+                    sqlite3_check_err(sqlite3_finalize(stmt));
+                    ////////////////////////////
+
+                    if(import_progress.track_done(track.title, track.st.st_size))
+                        ui_wakeup.notify();
+                }
+                if(albums_added) {
+                    char* errmsg = NULL;
+                    sqlite3_exec(db, SQL_FIX_ALBUM_SORT, NULL, NULL, &errmsg);
+                    if(errmsg != NULL) {
+                        std::cout << "Failed to fix album sort - " << errmsg << "\n";
+                        sqlite3_free(errmsg);
+                    }
+                    // The resort recreated the album tables without them
+                    if(session_indexes.active()) session_indexes.create();
+                }
+                sqlite3_check_err(sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL));
+            } catch(...) {
+                // Drop the half written batch before anyone else gets the db
+                sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+                throw;
+            }
+            done += stop - start;
+            import_journal.end_batch(job.directory, done, files[stop - 1]);
+            import_jobs.progress(job.id, done, total);
+            start = stop;
         }
+        if(cancelled)
+            std::cout << "Cancelled " << base << " after " << done << " tracks\n";
+        else if(needs_refine)
+            import_jobs.enqueue(job.directory, ImportJob::Kind::Refine);
+
+        std::lock_guard<std::mutex> lock(db_mutex);
         // Update counts
         std::cout << "counts" << "\n";
         sqlite3_check_err(sqlite3_prepare_v2(db, SQL_UPDATE_COUNT_TABLE1, strlen(SQL_UPDATE_COUNT_TABLE1), &stmt, NULL));
@@ -396,16 +734,323 @@ int main(int argc, char *argv[]) {
         sqlite3_check_err(sqlite3_prepare_v2(db, SQL_UPDATE_COUNT_TABLE3, strlen(SQL_UPDATE_COUNT_TABLE3), &stmt, NULL));
         sqlite3_check_err(sqlite3_step(stmt));
         sqlite3_check_err(sqlite3_finalize(stmt));
+        if(looked_up > 0)
+            std::cout << "Lookups: " << std::chrono::duration_cast<std::chrono::microseconds>(lookup_time).count() / looked_up
+                << "us/track" << (session_indexes.active() ? "" : " (no session indexes)") << "\n";
+        if(imported > 0) {
+            import_arena.reset();
+#ifdef TAGADDER_COUNT_ALLOCS
+            std::cout << "Heap allocations: " << (heap_allocs - allocs_start) / imported << "/track (TagLib included)\n";
+#endif
+            std::cout << "Arena " << import_arena.high_water() / 1024 << "KB of " << import_arena.capacity() / 1024 << "KB\n";
+        }
+    };
+
+    // Second pass over an imported directory: exact sample rate and bitrate
+    // for the formats where the fast first read estimates them (VBR MP3
+    // without a Xing header, M4A). Only rows that change are written.
+    auto refine = [&](const ImportJob& job) {
+        auto started = std::chrono::steady_clock::now();
+        std::string relative;
+        const Volume* volume = volumes.resolve(job.directory, relative);
+        if(volume == nullptr)
+            throw std::runtime_error("its volume isn't mounted");
+        std::vector<std::string> files;
+        for(auto& entry : fs::directory_iterator{volume->mount + relative})
+            if(is_supported(entry.path())) files.push_back(entry.path().u8string());
+        std::sort(files.begin(), files.end());
+        order_by_layout(files);
+
+        std::string select, updates[2];
+        {
+            std::lock_guard<std::mutex> lock(db_mutex);
+            std::string path_column = column_name(db, "MEDIA_TABLE", 1);
+            std::string hz = column_name(db, "MEDIA_TABLE", 15), bitrate = column_name(db, "MEDIA_TABLE", 16);
+            if(path_column.empty() || hz.empty() || bitrate.empty())
+                throw std::runtime_error("unexpected MEDIA_TABLE layout");
+            select = "SELECT id, " + quote_name(hz) + ", " + quote_name(bitrate) + " FROM MEDIA_TABLE WHERE " +
+                quote_name(path_column) + " IN (?, ?) LIMIT 1;";
+            const char* tables[2] = {"MEDIA_TABLE", "MEDIA2_TABLE"};
+            for(int t = 0; t < 2; ++t) {
+                hz = column_name(db, tables[t], 15);
+                bitrate = column_name(db, tables[t], 16);
+                if(hz.empty() || bitrate.empty()) continue;
+                updates[t] = std::string("UPDATE ") + tables[t] + " SET " + quote_name(hz) + " = ?, " +
+                    quote_name(bitrate) + " = ? WHERE id = ?;";
+            }
+        }
+
+        struct Refined { int id, sample_rate, bitrate; };
+        std::vector<Refined> pending;
+        uint32_t checked = 0, changed = 0;
+        // One transaction per batch of changed rows
+        auto write = [&] {
+            if(pending.empty()) return;
+            std::lock_guard<std::mutex> lock(db_mutex);
+            sqlite3_check_err(sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL));
+            try {
+                for(auto& row : pending) {
+                    for(auto& update : updates) {
+                        if(update.empty()) continue;
+                        sqlite3_check_err(sqlite3_prepare_v2(db, update.c_str(), update.size(), &stmt, NULL));
+                        sqlite3_check_err(sqlite3_bind_int(stmt, 1, row.sample_rate));
+                        sqlite3_check_err(sqlite3_bind_int(stmt, 2, row.bitrate));
+                        sqlite3_check_err(sqlite3_bind_int(stmt, 3, row.id));
+                        sqlite3_check_err(sqlite3_step(stmt));
+                        sqlite3_check_err(sqlite3_finalize(stmt));
+                    }
+                }
+                sqlite3_check_err(sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL));
+            } catch(...) {
+                sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+                throw;
+            }
+            changed += pending.size();
+            pending.clear();
+        };
 
-        current_loading.store(&should_not_see);
+        std::string path;
+        for(size_t i = 0; i < files.size(); ++i) {
+            if(!import_jobs.progress(job.id, i, files.size())) break;
+            AudioFormat format = detect_file_format(files[i].c_str());
+            if(format != AudioFormat::Mpeg && format != AudioFormat::Mp4) continue;
+
+            // What the first pass stored, nothing if it didn't import the file
+            Refined row{0, 0, 0};
+            path.clear();
+            volume->db_path(files[i], path);
+            {
+                std::lock_guard<std::mutex> lock(db_mutex);
+                sqlite3_check_err(sqlite3_prepare_v2(db, select.c_str(), select.size(), &stmt, NULL));
+                sqlite3_check_err(sqlite3_bind_text(stmt, 1, path.data(), path.size() + 1, SQLITE_STATIC));
+                sqlite3_check_err(sqlite3_bind_text(stmt, 2, path.data(), path.size(), SQLITE_STATIC));
+                if(sqlite3_step(stmt) == SQLITE_ROW)
+                    row = Refined{sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1), sqlite3_column_int(stmt, 2)};
+                sqlite3_check_err(sqlite3_finalize(stmt));
+            }
+            if(row.id == 0) continue;
+
+            TagLib::File* file = open_track(files[i].c_str(), format, TagLib::AudioProperties::Accurate);
+            if(file == nullptr || !file->isValid()) {
+                delete file;
+                continue;
+            }
+            TagLib::FileRef track(file);
+            checked += 1;
+            int sample_rate = track.audioProperties()->sampleRate();
+            int bitrate = track.audioProperties()->bitrate();
+            if(sample_rate == row.sample_rate && bitrate == row.bitrate) continue;
+            std::cout << "Refined " << files[i] << ": " << row.bitrate << " -> " << bitrate << "kbps, "
+                << row.sample_rate << " -> " << sample_rate << "Hz\n";
+            pending.push_back(Refined{row.id, sample_rate, bitrate});
+            if(pending.size() >= memory_governor.update().batch) write();
+        }
+        write();
+        std::cout << "Refined " << job.directory << ": " << changed << " of " << checked << " tracks changed in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count() << "ms\n";
     };
-    std::cout << "Extensions: " << TagLib::FileRef::defaultFileExtensions().toString(", ") << "\n";
 
-    // Local touch x, y copy and current selected directory index
-    uint32_t x, y, selected(0);
+    // Delete rows whose files are gone from the cards (deleted, or renamed and
+    // imported again under the new name), and the album/artist counts they
+    // held. Volumes that aren't mounted keep their rows.
+    auto reconcile = [&](const ImportJob& job) {
+        auto started = std::chrono::steady_clock::now();
+        ReconcileStats stats;
+        bool cancelled = false;
+        for(const Volume& volume : volumes.all()) {
+            // Takes db_mutex only to read the rows, the other card's importer
+            // keeps going while this card is walked
+            ReconcileStats volume_stats;
+            bool found = find_orphans(db, db_mutex, volume.mount, volume.drive,
+                    [&](const std::string& name){ return is_supported(fs::path(name)); },
+                    [&]{
+                        cancelled = !import_jobs.progress(job.id, (uint32_t)(stats.rows + volume_stats.rows), 0);
+                        return !cancelled;
+                    },
+                    volume_stats);
+            stats.rows += volume_stats.rows;
+            if(cancelled) {
+                std::cout << "Reconcile of " << volume.name << " cancelled after " << volume_stats.rows << " rows\n";
+                return;
+            }
+            // Reported as failed, so it's clear nothing was tidied
+            if(!found)
+                throw std::runtime_error("couldn't check " + volume.name + ", nothing deleted there");
+            std::lock_guard<std::mutex> lock(db_mutex);
+            std::cout << "Reconcile " << volume.name << ": " << volume_stats.rows << " rows, " << volume_stats.missing << " missing, "
+                << volume_stats.duplicates << " duplicates\n";
+            if(volume_stats.missing + volume_stats.duplicates > 0) {
+                // All or nothing
+                std::string mtime_col = column_name(db, "MTIME_TABLE", 0);
+                std::string sql = std::string("BEGIN;") + SQL_RECONCILE_APPLY;
+                if(!mtime_col.empty())
+                    sql += "DELETE FROM MTIME_TABLE WHERE " + quote_name(mtime_col) + " IN (SELECT id FROM temp.RECONCILE_GONE);";
+                sql += std::string(SQL_UPDATE_COUNT_TABLE1) + SQL_UPDATE_COUNT_TABLE2 + SQL_UPDATE_COUNT_TABLE3 + "COMMIT;";
+                char* errmsg = NULL;
+                sqlite3_exec(db, sql.c_str(), NULL, NULL, &errmsg);
+                if(errmsg != NULL) {
+                    std::string error = errmsg;
+                    sqlite3_free(errmsg);
+                    // Drop the half applied transaction, if any
+                    sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+                    throw std::runtime_error("reconcile failed - " + error);
+                }
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(db_mutex);
+            sqlite3_exec(db, "DELETE FROM temp.RECONCILE_GONE;", NULL, NULL, NULL);
+        }
+        import_jobs.progress(job.id, (uint32_t)stats.rows, (uint32_t)stats.rows);
+        std::cout << "Reconcile took "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count() << "ms\n";
+    };
+
+    // Regenerate album/artist tables and counts from MEDIA_TABLE, fixing cn
+    // counts and album order that drifted over many imports
+    auto rebuild = [&](const ImportJob& job) {
+        auto started = std::chrono::steady_clock::now();
+        std::string rebuild_sql = rebuild_indexes_sql(db);
+        if(rebuild_sql.empty())
+            throw std::runtime_error("unexpected MEDIA_TABLE layout");
+        // All or nothing
+        std::string sql = "BEGIN;" + rebuild_sql + SQL_UPDATE_COUNT_TABLE1 + SQL_UPDATE_COUNT_TABLE2 + SQL_UPDATE_COUNT_TABLE3 + "COMMIT;";
+        char* errmsg = NULL;
+        sqlite3_exec(db, sql.c_str(), NULL, NULL, &errmsg);
+        if(errmsg != NULL) {
+            std::string error = errmsg;
+            sqlite3_free(errmsg);
+            throw std::runtime_error("rebuild failed - " + error);
+        }
+
+        const char* query = "SELECT (SELECT COUNT(*) FROM MEDIA_TABLE), (SELECT COUNT(*) FROM ALBUM_TABLE), (SELECT COUNT(*) FROM ARTIST_TABLE);";
+        sqlite3_check_err(sqlite3_prepare_v2(db, query, strlen(query), &stmt, NULL));
+        sqlite3_check_err(sqlite3_step(stmt));
+        int tracks = sqlite3_column_int(stmt, 0);
+        std::cout << "Rebuilt " << sqlite3_column_int(stmt, 1) << " albums and " << sqlite3_column_int(stmt, 2)
+            << " artists from " << tracks << " tracks in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count() << "ms\n";
+        sqlite3_check_err(sqlite3_finalize(stmt));
+        import_jobs.progress(job.id, tracks, tracks);
+    };
+
+    // Requeue imports a previous run didn't finish
+    import_journal.load();
+    for(auto& entry : import_journal.entries()) {
+        std::string relative;
+        if(volumes.resolve(entry.directory, relative) == nullptr) {
+            std::cout << "Not resuming " << entry.directory << " yet, its card isn't mounted\n";
+            continue;
+        }
+        if(entry.batch_open) {
+            // Died around a commit, the batch's ids tell whether it made it
+            const char* query = "SELECT COUNT(*) FROM MEDIA_TABLE WHERE id BETWEEN ? AND ?;";
+            sqlite3_check_err(sqlite3_prepare_v2(db, query, strlen(query), &stmt, NULL));
+            sqlite3_check_err(sqlite3_bind_int(stmt, 1, entry.batch_first));
+            sqlite3_check_err(sqlite3_bind_int(stmt, 2, entry.batch_last));
+            sqlite3_check_err(sqlite3_step(stmt));
+            int found = sqlite3_column_int(stmt, 0);
+            sqlite3_check_err(sqlite3_finalize(stmt));
+            if(found == entry.batch_last - entry.batch_first + 1) {
+                std::cout << "Last batch of " << entry.directory << " was committed\n";
+                import_journal.end_batch(entry.directory, entry.files_done + entry.batch_files, entry.batch_end);
+            } else {
+                // Partly there if files were skipped as already imported,
+                // redoing it skips those again
+                if(found != 0)
+                    std::cout << "Ids " << entry.batch_first << "-" << entry.batch_last << " partly in use, redoing the batch\n";
+                import_journal.end_batch(entry.directory, entry.files_done, entry.last_path);
+            }
+        }
+        std::cout << "Resuming import of " << entry.directory << "\n";
+        import_jobs.enqueue(entry.directory);
+    }
+
+    // Imports run here so browsing stays responsive. One importer per disk
+    // so two cards are read at the same time; they're the only threads using
+    // db from now on, and take turns through db_mutex. The first one also
+    // runs the jobs that work on the whole db.
+    auto importer = [&](size_t worker, dev_t device) {
+        lower_thread_priority();
+        auto accept = [&, worker, device](const ImportJob& job) {
+            // Imports and refines go to the importer of their card
+            if(job.kind != ImportJob::Kind::Import && job.kind != ImportJob::Kind::Refine) return worker == 0;
+            std::string relative;
+            const Volume* volume = volumes.resolve(job.directory, relative);
+            // Nobody's disk, the first importer reports it failed
+            return volume != nullptr ? volume->device == device : worker == 0;
+        };
+        ImportJob job;
+        while(import_jobs.take(job, accept)) {
+            ui_wakeup.notify();
+            {
+                // Under the lock end() below is decided under, so a session
+                // can't be ended right after this job joined it
+                std::lock_guard<std::mutex> lock(db_mutex);
+                power_session.begin();
+                if(!session_indexes.active()) session_indexes.create();
+            }
+            bool ok = true;
+            try {
+                if(job.kind == ImportJob::Kind::Import) {
+                    load_songs(job);
+                } else if(job.kind == ImportJob::Kind::Refine) {
+                    refine(job);
+                } else if(job.kind == ImportJob::Kind::Reconcile) {
+                    // Takes db_mutex itself, not while the cards are walked
+                    reconcile(job);
+                } else {
+                    std::lock_guard<std::mutex> lock(db_mutex);
+                    try {
+                        rebuild(job);
+                    } catch(...) {
+                        // Drop the half applied transaction, if any
+                        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+                        throw;
+                    }
+                }
+            } catch(const std::exception& e) {
+                std::cout << "Import of " << job.directory << " failed - " << e.what() << "\n";
+                ok = false;
+            }
+            // Jobs stopped by exiting pick up where they were next time
+            if(job.kind == ImportJob::Kind::Import && !import_jobs.stopping())
+                import_journal.remove(job.directory);
+            import_jobs.finish(job.id, ok);
+            // Session over once nothing else is waiting
+            {
+                std::lock_guard<std::mutex> lock(db_mutex);
+                if(!import_jobs.busy()) {
+                    session_indexes.drop();
+                    power_session.end();
+                }
+            }
+            ui_wakeup.notify();
+        }
+        std::lock_guard<std::mutex> lock(db_mutex);
+        session_indexes.drop();
+        power_session.end();
+    };
+    std::vector<dev_t> devices = volumes.devices();
+    if(devices.empty()) devices.push_back(0);
+    std::vector<std::thread> importers;
+    for(size_t worker = 0; worker < devices.size(); ++worker)
+        importers.emplace_back(importer, worker, devices[worker]);
+
+    // Local touch x, y copy and current selected directory
+    uint32_t x, y;
+    std::string selected;
+    Gesture gesture;
+    LatencyStats input_latency;
+    unsigned long input_seen = 0;
+    // Touches from before this (kernel clock) were meant for the native GUI
+    int64_t accept_after_us = now_us(input_clock.load());
 
     // Start UI
-    state.store(local_state);
+    publish();
+    std::cout << "Startup took "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - process_start).count()
+        << "ms, RSS " << self_rss_kb() << "kB\n";
 
     /*
      * Monitor input and perform actions as set
@@ -413,60 +1058,122 @@ int main(int argc, char *argv[]) {
     while(1) {
         // Wait for some valid touch input
         // std::cout << "Main thread wait\n";
-        semaphore.acquire();
-        // std::cout << "Main thread read\n";
-        // TODO Can be raced that another touch happens inbetween acquire and here s.t. another trigger is queued again but the input x/y is duplicated
-        x = input_x.load();
-        y = input_y.load();
-        // std::cout << "Main thread " << x << ", " << y << " @ " << local_state << "\n";
+        while(!input_queue.pop(gesture))
+            input_seen = input_wakeup.wait(input_seen);
+        if(gesture.time_us < accept_after_us) {
+            std::cout << "Dropping input from before startup\n";
+            continue;
+        }
+        // A touch on the blanked panel only turns it back on
+        if(power_session.wake()) {
+            ui_wakeup.notify();
+            continue;
+        }
+        x = gesture.x;
+        y = gesture.y;
+        int64_t latency = now_us(input_clock.load()) - gesture.time_us;
+        input_latency.add(latency);
+        std::cout << "Input latency " << latency / 1000 << "ms (avg "
+            << input_latency.average_us() / 1000 << "ms, max " << input_latency.max_us / 1000 << "ms)\n";
+        // std::cout << "Main thread " << x << ", " << y << " @ " << model.state << "\n";
+
+        // Vertical swipes scroll the index, nothing else uses them
+        if(gesture.kind == Gesture::Kind::Swipe) {
+            if(model.state != 0 || std::abs(gesture.dy) < std::abs(gesture.dx)) continue;
+            scroll_to(model.scroll - gesture.dy);
+            continue;
+        }
+        // Long presses act like taps so a slow touch still hits the button
 
         // If statement allows for break...
-        if(local_state == 0) { // Index
-            // Up/down
-            if(y >= 430 && x > 150 && x < 290 && (page + 1) * 5 < entries.size()) {
+        if(model.state == 0) { // Index
+            // Up/down a page
+            if(y >= 430 && x > 150 && x < 290) {
                 std::cout << "Page up\n";
-                page += 1;
-                update_directory_strings();
+                scroll_to(model.scroll + LIST_ROWS * ROW_HEIGHT);
             }
-            if(y >= 430 && x < 140 && page > 0) {
+            if(y >= 430 && x < 140) {
                 std::cout << "Page down\n";
-                page -= 1;
-                update_directory_strings();
+                scroll_to(model.scroll - LIST_ROWS * ROW_HEIGHT);
             }
 
-            if(y >= 125 && y < 375) { // Select a directory
-                selected = (y - 125) / 50;
-                if(directories[selected] == " - ") continue;
-                current_loading.store(&directories[selected]);
-                local_state = 1;
-                state.store(local_state);
+            if(y >= LIST_TOP && y < LIST_TOP + LIST_ROWS * ROW_HEIGHT) { // Select a directory
+                size_t row = (model.scroll + y - LIST_TOP) / ROW_HEIGHT;
+                if(row >= dirs->size()) continue;
+                selected = (*dirs)[row];
+                copy_utf8(model.selected, selected);
+                model.state = 1;
+                publish();
+            }
+
+            if(y < LIST_TOP && x >= 240) { // Jobs
+                model.state = 2;
+                publish();
             }
 
             if(y > 430 && x > 310) { // Exit
                 exit_thread.store(true);
                 break;
             }
-        } else if(local_state == 1) { // Confirm yes/no
+        } else if(model.state == 1) { // Confirm yes/no
             if(y >= 430 && x < 140) { // Yes
-                local_state = 2;
-                state.store(local_state);
-                // Load songs
-                load_songs(selected);
-                
-                // Done
-                local_state = 0;
-                state.store(local_state);
+                // Queue it and keep browsing, more can be queued meanwhile
+                // Journal first, the worker may finish it before enqueue returns
+                import_journal.add(selected);
+                if(import_jobs.enqueue(selected) == 0)
+                    std::cout << selected << " is already queued\n";
+                model.state = 0;
+                publish();
+            }
+
+            if(y >= 430 && x > 150 && x < 290) { // No
+                model.state = 0;
+                publish();
+            }
+        } else if(model.state == 2) { // Jobs
+            if(y >= JOBS_TOP && y < JOBS_TOP + JOB_ROWS * JOB_ROW_HEIGHT) { // Cancel one
+                // Same order the render thread lists them in
+                auto jobs = import_jobs.snapshot();
+                size_t row = (y - JOBS_TOP) / JOB_ROW_HEIGHT;
+                if(row < jobs.size() && import_jobs.cancel(jobs[row].id)) {
+                    std::cout << "Cancelling " << jobs[row].directory << "\n";
+                    // A running job is forgotten by the worker once it stops
+                    if(jobs[row].status == ImportJob::Status::Queued)
+                        import_journal.remove(jobs[row].directory);
+                    ui_wakeup.notify();
+                }
+            }
+
+            if(y >= 430 && x < 140) { // Back
+                model.state = 0;
+                publish();
+            }
+
+            if(y >= 430 && x > 150 && x < 290) { // Cancel all
+                for(auto& job : import_jobs.snapshot()) {
+                    if(import_jobs.cancel(job.id) && job.status == ImportJob::Status::Queued)
+                        import_journal.remove(job.directory);
+                }
+                ui_wakeup.notify();
+            }
+
+            if(y >= 430 && x > 300 && x < 360) { // Tidy: drop rows of files no longer on the card
+                import_jobs.enqueue(u8"(remove missing files)", ImportJob::Kind::Reconcile);
+                ui_wakeup.notify();
             }
 
-            if(y >= 430 && x > 150 && x < 290) { // Yes
-                local_state = 0;
-                state.store(local_state);
+            if(y >= 430 && x > 370) { // Rebuild album/artist lists and counts
+                import_jobs.enqueue(u8"(rebuild albums and artists)", ImportJob::Kind::Rebuild);
+                ui_wakeup.notify();
             }
         }
     }
 
-    // Signal exit
+    // Signal exit, a running import stops after its current track
+    import_jobs.shutdown();
+    for(auto& thread : importers) thread.join();
     exit_thread.store(true);
+    ui_wakeup.notify();
     sleep(1);
     if(touch.joinable())
         touch.join();
@@ -479,21 +1186,15 @@ int main(int argc, char *argv[]) {
     std::cout << "End\n";
 
     // Relaunch native UI
-    system("( nohup /bin/sh /usr/bin/hiby_player.sh & )");
+    ProcessControl::spawn_detached({"/bin/sh", "/usr/bin/hiby_player.sh"});
     exit(0);
 }
 
 /////////////////////////
 
-// Cuts off at w, h
-void draw_string(ssfn_t& ctx, uint32_t x, uint32_t y, std::string str, uint32_t fg, uint32_t bg, uint32_t w, uint32_t h) {
-    // std::cout << "rendering " << str << "\n";
-    ssfn_glyph_t *glyph;
-    char* ptr = str.data();
-
-    // Processed bytes in string
-    ssize_t processed = 0;
-
+// Blend an alpha bitmap with its top left at (x, y), only inside clip
+void blend_glyph(const uint8_t* data, uint32_t pitch, int32_t w, int32_t h, int32_t x, int32_t y,
+        uint32_t fg, uint32_t bg, const Rect& clip) {
     // r/g/b uint_8 of fg and bg as double for scaling
     double fg_r = (double)((fg >> 16) & 0xff);
     double fg_g = (double)((fg >> 8) & 0xff);
@@ -502,8 +1203,35 @@ void draw_string(ssfn_t& ctx, uint32_t x, uint32_t y, std::string str, uint32_t
     double bg_g = (double)((bg >> 8) & 0xff);
     double bg_b = (double)((bg >> 0) & 0xff);
 
+    for(int32_t Y = 0; Y < h; ++Y) {
+        int32_t py = Y + y;
+        if(py < clip.y) continue;
+        if(py >= clip.bottom()) break;
+        for(int32_t X = 0; X < w && (X + x) < clip.right(); ++X) {
+            if(X + x < clip.x) continue;
+            uint8_t amt = (*(data + pitch * Y + X));
+            if(amt == 0) continue; // skip assumed pre-drawn background box
+
+            // out = fg * amt/255 + bg * (1 - amt/255)
+            double frac = (double)amt / 255.;
+            uint8_t color_r = std::round(frac * fg_r + (1. - frac) * bg_r);
+            uint8_t color_g = std::round(frac * fg_g + (1. - frac) * bg_g);
+            uint8_t color_b = std::round(frac * fg_b + (1. - frac) * bg_b);
+
+            tfb_draw_pixel(X + x, py, tfb_make_color(color_r, color_g, color_b));
+        }
+    }
+}
+
+// Only pixels inside clip are touched
+void draw_string(ssfn_t& ctx, int32_t x, int32_t y, const std::string& str, uint32_t fg, uint32_t bg, const Rect& clip) {
+    // std::cout << "rendering " << str << "\n";
+    ssfn_glyph_t *glyph;
+    // ssfn_utf8 only reads through this
+    char* ptr = const_cast<char*>(str.data());
+
     // While there are characters left...
-    while(ptr < (str.c_str() + str.size()) && x < w && y < h) {
+    while(ptr < (str.c_str() + str.size()) && x < clip.right()) {
         // Get code point
         uint32_t code = ssfn_utf8(&ptr);
 
@@ -515,26 +1243,23 @@ void draw_string(ssfn_t& ctx, uint32_t x, uint32_t y, std::string str, uint32_t
         }
 
         // Draw glyph
-        for(uint32_t Y = 0; Y < glyph->h && (Y + y - glyph->baseline) < h && (Y + y - glyph->baseline) >= 0; ++Y) {
-            for(uint32_t X = 0; X < glyph->w && (X + x) < w; ++X) {
-                uint8_t amt = (*(glyph->data + glyph->pitch * Y + X));
-                if(amt == 0) continue; // skip assumed pre-drawn background box
-
-                // out = fg * amt/255 + bg * (1 - amt/255)
-                double frac = (double)amt / 255.;
-                uint8_t color_r = std::round(frac * fg_r + (1. - frac) * bg_r);
-                uint8_t color_g = std::round(frac * fg_g + (1. - frac) * bg_g);
-                uint8_t color_b = std::round(frac * fg_b + (1. - frac) * bg_b);
-
-                tfb_draw_pixel(X + x, Y + y - glyph->baseline, tfb_make_color(color_r, color_g, color_b));
-            }
-        }
+        blend_glyph(glyph->data, glyph->pitch, glyph->w, glyph->h, x, y - glyph->baseline, fg, bg, clip);
 
         x += glyph->adv_x;
         free(glyph);
     }
 }
 
+// Same as draw_string from the prebaked atlas, check atlas_covers first
+void draw_atlas_string(uint32_t size, int32_t x, int32_t y, const std::string& str, uint32_t fg, uint32_t bg, const Rect& clip) {
+    for(unsigned char c : str) {
+        if(x >= clip.right()) break;
+        const AtlasGlyph* glyph = atlas_glyph(size, c);
+        blend_glyph(atlas_pixels(*glyph), glyph->w, glyph->w, glyph->h, x, y - glyph->baseline, fg, bg, clip);
+        x += glyph->adv_x;
+    }
+}
+
 void render_thread() {
     std::cout << "hi from render thread\n";
     int rc;
@@ -544,111 +1269,338 @@ void render_thread() {
       return;
     }
 
-    uint32_t w = tfb_screen_width();
-    uint32_t h = tfb_screen_height();
-    uint32_t rect_w = w / 2;
-    uint32_t rect_h = h / 2;
+    int32_t w = tfb_screen_width();
+    int32_t h = tfb_screen_height();
 
     tfb_clear_screen(tfb_black);
     tfb_draw_string(10, 10, tfb_white, tfb_black, "Initializing...");
     tfb_flush_window();
     tfb_flush_fb();
-    usleep(200000);
 
-    // Load ssfn fonts in
+    // Load ssfn fonts in once something isn't covered by the atlas
     ssfn_t ctx = {0};
-    for(auto& font_binary_i : font_binary) {
-        ssfn_load(&ctx, (ssfn_font_t*)font_binary_i.c_str());
-    }
+    bool fonts_loaded = false;
+    uint32_t font_size = 0;
     auto set_font_size = [&](uint32_t size) {
+        if(!fonts_loaded) {
+            for(auto& font_binary_i : font_binary) {
+                ssfn_load(&ctx, (const ssfn_font_t*)font_binary_i.data());
+            }
+            fonts_loaded = true;
+        }
+        if(size == font_size) return;
+        font_size = size;
         ssfn_select(&ctx,
                 SSFN_FAMILY_ANY, NULL,
                 SSFN_STYLE_REGULAR, size, SSFN_MODE_ALPHA);
     };
 
-    uint32_t state_cache(1); // set first
-    const char* cache_loading = NULL;
-
-    while(!exit_thread.load() && usleep(16666) == 0) {
-        if(state.load() != state_cache) {
-            state_cache = state.load();
-            tfb_clear_screen(tfb_black);
-            switch(state_cache) {
-                case 0:
-                // Index
-                set_font_size(36);
-                draw_string(ctx, 15, 50, u8"Hello!", tfb_white, tfb_black, w, h);
-
-                // Directories
-                set_font_size(20);
-                tfb_draw_rect(5, 125, w - 5, 50, tfb_magenta);
-                draw_string(ctx, 10, 156, directories[0].data(), tfb_red, tfb_black, w, h);
-                tfb_draw_rect(5, 175, w - 5, 50, tfb_magenta);
-                draw_string(ctx, 10, 206, directories[1].data(), tfb_red, tfb_black, w, h);
-                tfb_draw_rect(5, 225, w - 5, 50, tfb_magenta);
-                draw_string(ctx, 10, 256, directories[2].data(), tfb_red, tfb_black, w, h);
-                tfb_draw_rect(5, 275, w - 5, 50, tfb_magenta);
-                draw_string(ctx, 10, 306, directories[3].data(), tfb_red, tfb_black, w, h);
-                tfb_draw_rect(5, 325, w - 5, 50, tfb_magenta);
-                draw_string(ctx, 10, 356, directories[4].data(), tfb_red, tfb_black, w, h);
-                
-                
-                set_font_size(20);
-                // Up/Down buttons
-                tfb_fill_rect(0, 430, 140, 50, tfb_indigo);
-                draw_string(ctx, 50, 460, u8"Down", tfb_white, tfb_indigo, w, h);
-                tfb_fill_rect(150, 430, 140, 50, tfb_indigo);
-                draw_string(ctx, 210, 460, u8"Up", tfb_white, tfb_indigo, w, h);
-
-                // Exit button
-                tfb_fill_rect(300, 430, 60, 50, tfb_indigo);
-                draw_string(ctx, 312, 460, u8"Exit", tfb_white, tfb_indigo, w, h);
+    // Calls fn(data, pitch, w, h, baseline, adv_x) with the glyph for code
+    auto with_glyph = [&](uint32_t size, uint32_t code, auto&& fn) {
+        if(code < 0x80) {
+            if(const AtlasGlyph* g = atlas_glyph(size, code)) {
+                fn(atlas_pixels(*g), (uint32_t)g->w, (int32_t)g->w, (int32_t)g->h, (int32_t)g->baseline, (int32_t)g->adv_x);
+                return true;
+            }
+        }
+        set_font_size(size);
+        ssfn_glyph_t* glyph = ssfn_render(&ctx, code);
+        if(glyph == NULL) return false;
+        fn((const uint8_t*)glyph->data, (uint32_t)glyph->pitch, (int32_t)glyph->w, (int32_t)glyph->h,
+                (int32_t)glyph->baseline, (int32_t)glyph->adv_x);
+        free(glyph);
+        return true;
+    };
 
-                break;
-                case 1:
-                // Confirm
-                set_font_size(36);
-                draw_string(ctx, 15, 50, u8"Update this", tfb_white, tfb_black, w, h);
-                draw_string(ctx, 15, 122, u8"directory?", tfb_white, tfb_black, w, h);
-
-                set_font_size(16);
-                draw_string(ctx, 15, 250, current_loading.load()->data(), tfb_white, tfb_black, w, h);
-                
-                set_font_size(20);
-                tfb_fill_rect(0, 430, 140, 50, tfb_indigo);
-                draw_string(ctx, 50, 460, u8"Yes", tfb_white, tfb_indigo, w, h);
-                tfb_fill_rect(150, 430, 140, 50, tfb_indigo);
-                draw_string(ctx, 210, 460, u8"No", tfb_white, tfb_indigo, w, h);
-                break;
-                case 2:
-                // Loading songs (alternate to trigger screen update)
-                set_font_size(36);
-                draw_string(ctx, 15, 50, u8"Loading...", tfb_white, tfb_black, w, h);
-
-                cache_loading = NULL;
-                while(*current_loading.load() != should_not_see) {
-                    while(cache_loading == current_loading.load()->data()
-                            && usleep(1000) == 0) {}
-                    cache_loading = current_loading.load()->data();
-                    tfb_fill_rect(15, 100, w - 15, 300, tfb_black);
-                    set_font_size(20);
-                    draw_string(ctx, 15, 250, cache_loading, tfb_white, tfb_black, w, h);
-                    tfb_flush_window();
-                    tfb_flush_fb();
+    // Directory rows, shared with the main thread
+    std::shared_ptr<const std::vector<std::string>> rows;
+    // Rasterized rows so scrolling only blits, sized by memory_governor
+    RowCache row_cache(memory_governor.budget().row_cache);
+    const int32_t ROW_TEXT_SIZE = 20, ROW_TEXT_HEIGHT = 30, ROW_BASELINE = 22;
+
+    // Render one directory row into an alpha bitmap, ending in "..." if it's
+    // wider than the row
+    auto render_row = [&](size_t row) {
+        RowBitmap bmp;
+        bmp.w = w - 16;
+        bmp.h = ROW_TEXT_HEIGHT;
+        bmp.baseline = ROW_BASELINE;
+        bmp.alpha.assign((size_t)bmp.w * bmp.h, 0);
+
+        // Max blend the glyph into the bitmap with its pen at x
+        auto put = [&](int32_t x, const uint8_t* data, uint32_t pitch, int32_t gw, int32_t gh, int32_t baseline) {
+            for(int32_t Y = 0; Y < gh; ++Y) {
+                int32_t py = bmp.baseline - baseline + Y;
+                if(py < 0 || py >= bmp.h) continue;
+                for(int32_t X = 0; X < gw && x + X < bmp.w; ++X) {
+                    if(x + X < 0) continue;
+                    uint8_t& out = bmp.alpha[(size_t)py * bmp.w + x + X];
+                    out = std::max(out, data[pitch * Y + X]);
                 }
+            }
+        };
+
+        int32_t dot_adv = 0;
+        with_glyph(ROW_TEXT_SIZE, '.', [&](const uint8_t*, uint32_t, int32_t, int32_t, int32_t, int32_t adv) { dot_adv = adv; });
+        int32_t ellipsis_w = 3 * dot_adv;
+
+        // Pen position before each character, to know where to cut
+        std::vector<int32_t> pens;
+        const std::string& label = (*rows)[row];
+        char* ptr = const_cast<char*>(label.data());
+        int32_t pen = 0;
+        bool overflow = false;
+        while(ptr < label.c_str() + label.size()) {
+            uint32_t code = ssfn_utf8(&ptr);
+            pens.push_back(pen);
+            with_glyph(ROW_TEXT_SIZE, code, [&](const uint8_t* data, uint32_t pitch, int32_t gw, int32_t gh, int32_t baseline, int32_t adv) {
+                put(pen, data, pitch, gw, gh, baseline);
+                pen += adv;
+            });
+            if(pen > bmp.w) {
+                overflow = true;
                 break;
-                case 3:
-                // Loading dirs
-                tfb_draw_string(10, 10, tfb_white, tfb_black, "Loading directories...");
+            }
+        }
+        if(!overflow) return bmp;
+
+        // Drop characters until the ellipsis fits after them
+        int32_t cut = 0;
+        for(size_t i = pens.size(); i-- > 0;) {
+            if(pens[i] + ellipsis_w <= bmp.w) {
+                cut = pens[i];
                 break;
-                case 0xff:
-                // Still initializing
+            }
+        }
+        for(int32_t Y = 0; Y < bmp.h; ++Y)
+            std::fill(bmp.alpha.begin() + (size_t)Y * bmp.w + cut, bmp.alpha.begin() + (size_t)(Y + 1) * bmp.w, 0);
+        for(int32_t i = 0; i < 3; ++i)
+            with_glyph(ROW_TEXT_SIZE, '.', [&](const uint8_t* data, uint32_t pitch, int32_t gw, int32_t gh, int32_t baseline, int32_t) {
+                put(cut + i * dot_adv, data, pitch, gw, gh, baseline);
+            });
+        return bmp;
+    };
+
+    // Clipped one pixel outline
+    auto draw_frame = [&](const Rect& b, uint32_t color, const Rect& clip) {
+        const Rect edges[] = {
+            {b.x, b.y, b.w, 1}, {b.x, b.bottom() - 1, b.w, 1},
+            {b.x, b.y, 1, b.h}, {b.right() - 1, b.y, 1, b.h}};
+        for(auto& edge : edges) {
+            Rect e = edge.intersected(clip);
+            if(!e.empty()) tfb_fill_rect(e.x, e.y, e.w, e.h, color);
+        }
+    };
+
+    // Draws one widget, clipped
+    auto paint = [&](const Widget& wd, const Rect& clip) {
+        switch(wd.kind) {
+            case Widget::Kind::Fill:
+            tfb_fill_rect(clip.x, clip.y, clip.w, clip.h, wd.fg);
+            break;
+            case Widget::Kind::Frame:
+            draw_frame(wd.bounds, wd.fg, clip);
+            break;
+            case Widget::Kind::List: {
+            // Only the rows scrolled into view, each a frame plus a cached label
+            if(!rows) break;
+            row_cache.set_version(wd.version);
+            for(int32_t row = wd.scroll / ROW_HEIGHT; row < (int32_t)rows->size(); ++row) {
+                Rect r{wd.bounds.x, wd.bounds.y + row * ROW_HEIGHT - wd.scroll, wd.bounds.w, ROW_HEIGHT};
+                if(r.y >= clip.bottom()) break;
+                Rect visible = r.intersected(clip);
+                if(visible.empty()) continue;
+                draw_frame(r, tfb_magenta, visible);
+                const RowBitmap& bmp = row_cache.get(row, render_row);
+                blend_glyph(bmp.alpha.data(), bmp.w, bmp.w, bmp.h, r.x + 5, r.y + 31 - bmp.baseline,
+                        tfb_red, tfb_black, visible);
+            }
+            break;
+            }
+            case Widget::Kind::Text:
+            tfb_fill_rect(clip.x, clip.y, clip.w, clip.h, wd.bg);
+            if(atlas_covers(wd.size, wd.text)) {
+                draw_atlas_string(wd.size, wd.text_x, wd.text_y, wd.text, wd.fg, wd.bg, clip);
                 break;
             }
-            tfb_flush_window();
-            tfb_flush_fb();
+            set_font_size(wd.size);
+            draw_string(ctx, wd.text_x, wd.text_y, wd.text, wd.fg, wd.bg, clip);
+            break;
+        }
+    };
+
+    // Newest import progress seen
+    ProgressSnapshot progress{};
+    // Import jobs, refreshed every frame
+    std::vector<ImportJob> jobs;
+    // List offset on screen, eased toward the model's scroll
+    int32_t shown_scroll = 0;
+    uint32_t list_version_shown = 0;
+
+    // Describe the screen for a UI state
+    auto build_scene = [&](const UiModel& ui) {
+        std::vector<Widget> widgets;
+        switch(ui.state) {
+            case 0:
+            // Index
+            widgets.push_back(Widget::label(15, 50, 240, 36, u8"Hello!", tfb_white, tfb_black));
+
+            // Jobs button, shows how many imports are waiting or running
+            {
+                size_t pending = 0;
+                for(auto& job : jobs)
+                    if(job.status == ImportJob::Status::Queued || job.status == ImportJob::Status::Running) ++pending;
+                char line[32];
+                if(pending > 0) snprintf(line, sizeof(line), "Jobs (%zu)", pending);
+                else snprintf(line, sizeof(line), "Jobs");
+                widgets.push_back(Widget::fill(Rect{240, 15, w - 250, 50}, tfb_indigo));
+                widgets.push_back(Widget::label(250, 46, w - 10, 20, line, tfb_white, tfb_indigo));
+            }
+
+            // Directories
+            widgets.push_back(Widget::list(Rect{5, LIST_TOP, w - 5, LIST_ROWS * ROW_HEIGHT}, shown_scroll, ui.list_version));
+
+            // Up/Down buttons
+            widgets.push_back(Widget::fill(Rect{0, 430, 140, 50}, tfb_indigo));
+            widgets.push_back(Widget::label(50, 460, 140, 20, u8"Down", tfb_white, tfb_indigo));
+            widgets.push_back(Widget::fill(Rect{150, 430, 140, 50}, tfb_indigo));
+            widgets.push_back(Widget::label(210, 460, 290, 20, u8"Up", tfb_white, tfb_indigo));
+
+            // Exit button
+            widgets.push_back(Widget::fill(Rect{300, 430, 60, 50}, tfb_indigo));
+            widgets.push_back(Widget::label(312, 460, 360, 20, u8"Exit", tfb_white, tfb_indigo));
+            break;
+            case 1:
+            // Confirm
+            widgets.push_back(Widget::label(15, 50, w, 36, u8"Update this", tfb_white, tfb_black));
+            widgets.push_back(Widget::label(15, 122, w, 36, u8"directory?", tfb_white, tfb_black));
+            widgets.push_back(Widget::label(15, 250, w, 16, ui.selected, tfb_white, tfb_black));
+
+            widgets.push_back(Widget::fill(Rect{0, 430, 140, 50}, tfb_indigo));
+            widgets.push_back(Widget::label(50, 460, 140, 20, u8"Yes", tfb_white, tfb_indigo));
+            widgets.push_back(Widget::fill(Rect{150, 430, 140, 50}, tfb_indigo));
+            widgets.push_back(Widget::label(210, 460, 290, 20, u8"No", tfb_white, tfb_indigo));
+            break;
+            case 2: {
+            // Jobs; only the track row, bar, counters and statuses change between frames
+            widgets.push_back(Widget::label(15, 50, w, 36, u8"Jobs", tfb_white, tfb_black));
+
+            // Job being imported now
+            char line[160];
+            if(progress.active) {
+                widgets.push_back(Widget::label(15, 85, w, 16, progress.title, tfb_white, tfb_black));
+
+                int32_t bar_w = w - 30;
+                int32_t filled = progress.files_total == 0 ? 0
+                    : (int32_t)((uint64_t)(bar_w - 4) * std::min(progress.files_done, progress.files_total) / progress.files_total);
+                widgets.push_back(Widget::frame(Rect{15, 95, bar_w, 24}, tfb_magenta));
+                widgets.push_back(Widget::fill(Rect{17, 97, filled, 20}, tfb_indigo));
+
+                if(progress.files_done > 0)
+                    snprintf(line, sizeof(line), "%u / %u tracks, ETA %u:%02u", progress.files_done, progress.files_total,
+                            progress.eta_sec / 60, progress.eta_sec % 60);
+                else
+                    snprintf(line, sizeof(line), "%u / %u tracks", progress.files_done, progress.files_total);
+                widgets.push_back(Widget::label(15, 145, w, 20, line, tfb_white, tfb_black));
+            } else {
+                widgets.push_back(Widget::label(15, 145, w, 20, u8"Idle", tfb_white, tfb_black));
+            }
+
+            // Every job, tap one to cancel it
+            for(size_t i = 0; i < jobs.size() && i < (size_t)JOB_ROWS; ++i) {
+                const ImportJob& job = jobs[i];
+                snprintf(line, sizeof(line), "%s %u/%u %s%s", job_status_name(job.status),
+                        job.files_done, job.files_total, job.directory.c_str(),
+                        job.kind == ImportJob::Kind::Refine ? u8" (properties)" : "");
+                int32_t top = JOBS_TOP + JOB_ROW_HEIGHT * (int32_t)i;
+                uint32_t color = job.status == ImportJob::Status::Running ? tfb_white
+                    : job.status == ImportJob::Status::Queued ? tfb_red : tfb_magenta;
+                widgets.push_back(Widget::label(15, top + 21, w, 16, line, color, tfb_black));
+            }
+
+            snprintf(line, sizeof(line), "All jobs: %.1f tracks/s", ImportQueue::throughput(jobs));
+            widgets.push_back(Widget::label(15, 422, w, 16, line, tfb_white, tfb_black));
+
+            widgets.push_back(Widget::fill(Rect{0, 430, 140, 50}, tfb_indigo));
+            widgets.push_back(Widget::label(50, 460, 140, 20, u8"Back", tfb_white, tfb_indigo));
+            widgets.push_back(Widget::fill(Rect{150, 430, 140, 50}, tfb_indigo));
+            widgets.push_back(Widget::label(165, 460, 290, 20, u8"Cancel all", tfb_white, tfb_indigo));
+            widgets.push_back(Widget::fill(Rect{300, 430, 60, 50}, tfb_indigo));
+            widgets.push_back(Widget::label(312, 460, 360, 20, u8"Tidy", tfb_white, tfb_indigo));
+            widgets.push_back(Widget::fill(Rect{370, 430, 110, 50}, tfb_indigo));
+            widgets.push_back(Widget::label(385, 460, 480, 20, u8"Rebuild", tfb_white, tfb_indigo));
+            break;
+            }
+            case 3:
+            // Loading dirs
+            widgets.push_back(Widget::label(10, 26, w, 16, u8"Loading directories...", tfb_white, tfb_black));
+            break;
+            case 0xff:
+            // Still initializing
+            break;
+        }
+        return widgets;
+    };
+
+    Scene scene(Rect{0, 0, w, h}, tfb_black);
+
+    // Sleep until the UI changes instead of polling
+    unsigned long seen = 0;
+    bool interactive = false;
+    auto last_frame = std::chrono::steady_clock::now() - MIN_FRAME_INTERVAL;
+    while(!exit_thread.load()) {
+        seen = ui_wakeup.wait(seen);
+        if(exit_thread.load()) break;
+
+        auto next_frame = last_frame + MIN_FRAME_INTERVAL;
+        if(std::chrono::steady_clock::now() < next_frame)
+            std::this_thread::sleep_until(next_frame);
+        last_frame = std::chrono::steady_clock::now();
+
+        import_progress.latest(progress);
+        jobs = import_jobs.snapshot();
+        // Kept draining while the panel is off, only drawing waits for it
+        // to be back on
+        if(power_session.blanked()) continue;
+        UiModel ui = ui_model.load();
+        rows = std::atomic_load(&directory_list);
+        // Gives way to imports when memory gets tight
+        row_cache.set_budget(memory_governor.update().row_cache);
+
+        // Glide a third of the way each frame; a new list jumps straight there
+        if(ui.list_version != list_version_shown) {
+            list_version_shown = ui.list_version;
+            shown_scroll = ui.scroll;
+        }
+        int32_t diff = ui.scroll - shown_scroll;
+        if(diff != 0) {
+            int32_t step = std::max<int32_t>(4, std::abs(diff) / 3);
+            shown_scroll += diff > 0 ? std::min(step, diff) : std::max(-step, diff);
+            if(shown_scroll != ui.scroll) ui_wakeup.notify();
+        }
+
+        auto& dirty = scene.update(build_scene(ui), paint);
+        if(dirty.empty()) continue;
+        for(auto& r : dirty.rects())
+            tfb_flush_rect(r.x, r.y, r.w, r.h);
+        tfb_flush_fb();
+
+        // Rows just off screen are rendered now so they only need a blit
+        // once scrolled in
+        if(ui.state == 0 && rows) {
+            row_cache.set_version(ui.list_version);
+            int32_t first = shown_scroll / ROW_HEIGHT;
+            int32_t last = first + LIST_ROWS;
+            for(int32_t row = std::max(0, first - 2); row <= last + 2 && row < (int32_t)rows->size(); ++row)
+                row_cache.get(row, render_row);
+        }
+
+        if(!interactive && ui.state == 0) {
+            interactive = true;
+            std::cout << "First interactive frame at +"
+                << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - process_start).count()
+                << "ms\n";
         }
-        tfb_flush_window();
     }
     
     // Exiting
@@ -662,16 +1614,11 @@ void render_thread() {
     std::cout << "bye from render thread\n";
 }
 
-void touch_thread() {
+void touch_thread(int fd) {
     std::cout << "hi from touch thread\n";
-    auto fd = open("/dev/input/event2", O_RDONLY);
-    if(errno != 0) {
-        std::cout << "Can't open touchscreen " << strerror(errno) << "\n";
-        return;
-    }
 
-    struct input_event ev;
-    const size_t ev_size = sizeof(struct input_event);
+    // Read whatever is queued in one go
+    struct input_event events[64];
     ssize_t size;
 
     struct pollfd monitor;
@@ -679,28 +1626,48 @@ void touch_thread() {
     monitor.events = POLLIN;
     int ready;
 
+    GestureRecognizer recognizer;
+    Debouncer debouncer;
+    Gesture gesture;
+    auto deliver = [&]{
+        // Nothing reacts to input while loading, don't let it pile up
+        if(ui_model.load().state == 3) return;
+        if(!debouncer.accept(gesture)) {
+            std::cout << "Debounced touch at " << gesture.x << ", " << gesture.y << "\n";
+            return;
+        }
+        if(!input_queue.push(gesture)) {
+            std::cout << "Input queue full, dropping touch\n";
+            return;
+        }
+        input_wakeup.notify();
+    };
+
     while(!exit_thread.load()) {
-        ready = poll(&monitor, 1, 500);
+        ready = poll(&monitor, 1, recognizer.timeout_ms(now_us(input_clock.load()), 500));
         // std::cout << "poll returned " << ready << "\n";
-        if(ready == 0) continue;
+        if(ready == 0) {
+            // Long press while held
+            if(recognizer.tick(now_us(input_clock.load()), gesture)) deliver();
+            continue;
+        }
         if(ready < 0) {
             std::cout << "poll error " << ready << "\n";
             return;
         }
 
-        size = read(fd, &ev, ev_size);
-        if (size < ev_size) {
+        size = read(fd, events, sizeof(events));
+        if (size < (ssize_t)sizeof(struct input_event)) {
             std::cout << "touchscreen event error (wrong size)\n";
             return;
         }
 
-        // X always reported first
-        if (ev.type == EV_ABS && ev.code == ABS_MT_POSITION_X)
-            input_x.store(ev.value);
-        if (ev.type == EV_ABS && ev.code == ABS_MT_POSITION_Y) {
-            input_y.store(ev.value);
-            // std::cout << "Touched " << input_x.load() << ", " << input_y.load() << "\n";
-            semaphore.release();
+        // Contacts are assembled per SYN_REPORT frame
+        for(size_t i = 0; i < size / sizeof(struct input_event); ++i) {
+            if(recognizer.feed(events[i], gesture)) {
+                // std::cout << "Touched " << gesture.x << ", " << gesture.y << "\n";
+                deliver();
+            }
         }
     }
 
@@ -713,3 +1680,50 @@ void sqlite3_check_err(int code) {
         std::cout << "sqlite error code: " << sqlite3_errstr(code) << "\n";
     }
 }
+
+// Like echo value > path, without the shell
+bool write_sysfs(const char* path, const char* value) {
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if(fd < 0) {
+        std::cout << "Can't open " << path << " - " << strerror(errno) << "\n";
+        return false;
+    }
+    bool ok = write(fd, value, strlen(value)) == (ssize_t)strlen(value);
+    if(!ok) std::cout << "Can't write " << path << " - " << strerror(errno) << "\n";
+    close(fd);
+    return ok;
+}
+
+// The TagLib parser for a detected format, what FileRef would otherwise pick
+// by extension
+TagLib::File* open_track(const char* path, AudioFormat format, TagLib::AudioProperties::ReadStyle style) {
+    switch(format) {
+        case AudioFormat::Flac: return new TagLib::FLAC::File(path, true, style);
+        case AudioFormat::Mpeg: return new TagLib::MPEG::File(path, true, style);
+        case AudioFormat::OggVorbis: return new TagLib::Ogg::Vorbis::File(path, true, style);
+        case AudioFormat::OggOpus: return new TagLib::Ogg::Opus::File(path, true, style);
+        case AudioFormat::OggFlac: return new TagLib::Ogg::FLAC::File(path, true, style);
+        case AudioFormat::Wav: return new TagLib::RIFF::WAV::File(path, true, style);
+        case AudioFormat::Mp4: return new TagLib::MP4::File(path, true, style);
+        case AudioFormat::Unknown:
+        case AudioFormat::Other: break;
+    }
+    return nullptr;
+}
+
+#ifdef TAGADDER_COUNT_ALLOCS
+// The default allocator, counted per thread (heap_allocs)
+void* operator new(size_t size) {
+    heap_allocs += 1;
+    if(void* p = malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+#endif
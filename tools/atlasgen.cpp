@@ -0,0 +1,105 @@
+// Build-time helper, runs on the host: rasterizes printable ASCII from an SFN
+// font at the sizes the UI uses and writes them out as constexpr tables, so
+// the fixed labels can be drawn before (or without) the runtime font.
+//
+// usage: atlasgen <font.sfn> <output.h>
+// A missing font produces an empty atlas; the UI then uses the runtime font.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <ssfn.h>
+
+// Keep in sync with the sizes render_thread selects
+const int SIZES[] = {16, 20, 36};
+const uint32_t FIRST = 0x20, LAST = 0x7e;
+
+struct Glyph {
+    int w = 0, h = 0, baseline = 0, adv_x = 0;
+    size_t offset = 0;
+    bool present = false;
+};
+
+int main(int argc, char* argv[]) {
+    if(argc != 3) {
+        fprintf(stderr, "usage: %s <font.sfn> <output.h>\n", argv[0]);
+        return 1;
+    }
+
+    std::ifstream font_file(argv[1], std::ios::binary);
+    std::vector<char> font((std::istreambuf_iterator<char>(font_file)), std::istreambuf_iterator<char>());
+
+    ssfn_t ctx = {0};
+    bool baked = !font.empty() && ssfn_load(&ctx, (const ssfn_font_t*)font.data()) == SSFN_OK;
+    if(!baked)
+        fprintf(stderr, "atlasgen: can't load %s, writing an empty atlas\n", argv[1]);
+
+    std::vector<uint8_t> pixels;
+    std::vector<std::vector<Glyph>> faces;
+    for(int size : SIZES) {
+        std::vector<Glyph> glyphs(LAST - FIRST + 1);
+        if(baked && ssfn_select(&ctx, SSFN_FAMILY_ANY, NULL, SSFN_STYLE_REGULAR, size, SSFN_MODE_ALPHA) == SSFN_OK) {
+            for(uint32_t code = FIRST; code <= LAST; ++code) {
+                ssfn_glyph_t* glyph = ssfn_render(&ctx, code);
+                Glyph& g = glyphs[code - FIRST];
+                if(glyph == NULL) {
+                    // Blank glyphs may have no outline at all, still need an advance
+                    if(code == ' ') {
+                        g.adv_x = size / 4;
+                        g.present = true;
+                    }
+                    continue;
+                }
+                g.w = glyph->w;
+                g.h = glyph->h;
+                g.baseline = glyph->baseline;
+                g.adv_x = glyph->adv_x;
+                g.offset = pixels.size();
+                g.present = true;
+                // Pack rows tightly (pitch = w)
+                for(int y = 0; y < g.h; ++y)
+                    pixels.insert(pixels.end(), glyph->data + glyph->pitch * y, glyph->data + glyph->pitch * y + g.w);
+                free(glyph);
+            }
+        }
+        faces.push_back(glyphs);
+    }
+    ssfn_free(&ctx);
+
+    FILE* out = fopen(argv[2], "w");
+    if(out == NULL) {
+        perror("atlasgen");
+        return 1;
+    }
+    fprintf(out, "// Generated by tools/atlasgen.cpp from %s, do not edit\n", argv[1]);
+    fprintf(out, "constexpr bool ATLAS_BAKED = %s;\n", baked ? "true" : "false");
+    fprintf(out, "constexpr uint32_t ATLAS_FIRST = 0x%x, ATLAS_LAST = 0x%x;\n", FIRST, LAST);
+    fprintf(out, "constexpr uint32_t ATLAS_SIZES[%zu] = {", faces.size());
+    for(size_t i = 0; i < faces.size(); ++i) fprintf(out, "%s%d", i ? ", " : "", SIZES[i]);
+    fprintf(out, "};\n");
+
+    // {present, w, h, baseline, adv_x, offset}
+    fprintf(out, "constexpr AtlasGlyph ATLAS_GLYPHS[%zu][%u] = {\n", faces.size(), LAST - FIRST + 1);
+    for(auto& glyphs : faces) {
+        fprintf(out, "    {\n");
+        for(auto& g : glyphs)
+            fprintf(out, "        {%s, %d, %d, %d, %d, %zu},\n", g.present ? "true" : "false",
+                    g.w, g.h, g.baseline, g.adv_x, g.offset);
+        fprintf(out, "    },\n");
+    }
+    fprintf(out, "};\n");
+
+    fprintf(out, "constexpr uint8_t ATLAS_PIXELS[%zu] = {", pixels.empty() ? 1 : pixels.size());
+    if(pixels.empty()) fprintf(out, "0");
+    for(size_t i = 0; i < pixels.size(); ++i)
+        fprintf(out, "%s%u,", i % 24 == 0 ? "\n    " : "", pixels[i]);
+    fprintf(out, "\n};\n");
+    fclose(out);
+    return 0;
+}
@@ -0,0 +1,92 @@
+// Runs on the player (or any Linux box): times reading the start of every
+// audio file in a directory in listing order, name order and on-disk order
+// (layout.h), with the page cache dropped before each pass, to see what the
+// importer's layout ordering buys on a given card.
+//
+// usage: orderbench <directory> [bytes per file, default 65536]
+// Needs root for dropping caches (and FIBMAP where FIEMAP isn't supported).
+// Without a spare card a loopback FAT image works as well:
+//   truncate -s 2G card.img && mkfs.vfat card.img && mount -o loop card.img /mnt/test
+// then copy an album or two over and point orderbench at /mnt/test/<album>.
+// Loop devices sit on the host's disk, so the difference there is smaller
+// than on an SD card. No results from a real card have been recorded yet, so
+// the importer's ordering is unmeasured until someone runs this on one.
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "../format.h"
+#include "../layout.h"
+
+static bool drop_caches() {
+    sync();
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    if(fd < 0) return false;
+    bool ok = write(fd, "3", 1) == 1;
+    close(fd);
+    return ok;
+}
+
+// Wall time to read the first bytes of each file, in the given order
+static double read_pass(const std::vector<std::string>& files, size_t bytes) {
+    std::vector<char> buffer(bytes);
+    auto start = std::chrono::steady_clock::now();
+    for(auto& path : files) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0) continue;
+        size_t got = 0;
+        ssize_t n;
+        while(got < bytes && (n = read(fd, buffer.data() + got, bytes - got)) > 0) got += n;
+        close(fd);
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s <directory> [bytes per file]\n", argv[0]);
+        return 1;
+    }
+    std::string dir = argv[1];
+    if(dir.back() != '/') dir += '/';
+    size_t bytes = argc > 2 ? strtoul(argv[2], NULL, 10) : 65536;
+
+    std::vector<std::string> files;
+    DIR* handle = opendir(dir.c_str());
+    if(handle == NULL) {
+        perror(dir.c_str());
+        return 1;
+    }
+    while(struct dirent* ent = readdir(handle))
+        if(audio_extension(ent->d_name)) files.push_back(dir + ent->d_name);
+    closedir(handle);
+    std::vector<std::string> listed = files;
+    std::sort(files.begin(), files.end());
+    if(files.empty()) {
+        fprintf(stderr, "no audio files in %s\n", dir.c_str());
+        return 1;
+    }
+
+    std::vector<std::string> by_layout = files;
+    LayoutStats stats = order_by_layout(by_layout);
+    printf("%zu files, %zu bytes each; layout from %zu extents, %zu blocks, %zu inodes, %zu unknown\n",
+            files.size(), bytes, stats.fiemap, stats.fibmap, stats.inode, stats.failed);
+
+    if(!drop_caches()) fprintf(stderr, "can't drop caches (not root?), timings include cached reads\n");
+    double by_listing = read_pass(listed, bytes);
+    drop_caches();
+    double by_name = read_pass(files, bytes);
+    drop_caches();
+    double by_offset = read_pass(by_layout, bytes);
+    printf("listing order: %.3fs\nname order:    %.3fs\nlayout order:  %.3fs (%.2fx listing, %.2fx name)\n",
+            by_listing, by_name, by_offset, by_offset > 0 ? by_listing / by_offset : 0., by_offset > 0 ? by_name / by_offset : 0.);
+    return 0;
+}
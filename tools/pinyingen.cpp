@@ -0,0 +1,110 @@
+// Build-time helper, runs on the host: turns the kMandarin readings from
+// Unihan_Readings.txt into a table indexed directly by code point over the
+// CJK Unified Ideographs block, so a Han character's toneless pinyin is one
+// array load at runtime (sortkey.h).
+//
+// usage: pinyingen <Unihan_Readings.txt> <output.h>
+// A missing file produces an empty table; Han titles then sort under '#'.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+const uint32_t FIRST = 0x4e00, LAST = 0x9fff;
+
+static uint32_t next_code(const std::string& s, size_t& i) {
+    unsigned char c = s[i];
+    int len = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xe ? 3 : 4;
+    uint32_t code = len == 1 ? c : len == 2 ? c & 0x1f : len == 3 ? c & 0x0f : c & 0x07;
+    for(int k = 1; k < len && i + k < s.size(); ++k) code = (code << 6) | (s[i + k] & 0x3f);
+    i += len;
+    return code;
+}
+
+// "zhōng" -> "zhong", "lǜ" -> "lv"
+static std::string strip_tones(const std::string& reading) {
+    std::string out;
+    for(size_t i = 0; i < reading.size();) {
+        uint32_t code = next_code(reading, i);
+        if(code < 0x80) { out += (char)code; continue; }
+        if(code >= 0x300 && code <= 0x36f) continue; // Combining marks
+        switch(code) {
+            case 0xe0: case 0xe1: case 0x101: case 0x1ce: out += 'a'; break;
+            case 0xe8: case 0xe9: case 0xea: case 0x113: case 0x11b: out += 'e'; break;
+            case 0xec: case 0xed: case 0x12b: case 0x1d0: out += 'i'; break;
+            case 0xf2: case 0xf3: case 0x14d: case 0x1d2: out += 'o'; break;
+            case 0xf9: case 0xfa: case 0x16b: case 0x1d4: out += 'u'; break;
+            case 0xfc: case 0x1d6: case 0x1d8: case 0x1da: case 0x1dc: out += 'v'; break;
+            case 0x144: case 0x148: case 0x1f9: out += 'n'; break;
+            case 0x1e3f: out += 'm'; break;
+            default: break;
+        }
+    }
+    return out;
+}
+
+int main(int argc, char* argv[]) {
+    if(argc != 3) {
+        fprintf(stderr, "usage: %s <Unihan_Readings.txt> <output.h>\n", argv[0]);
+        return 1;
+    }
+
+    // Syllable 0 is "no reading"
+    std::vector<std::string> syllables{""};
+    std::map<std::string, uint16_t> syllable_index;
+    std::vector<uint16_t> table(LAST - FIRST + 1, 0);
+
+    std::ifstream in(argv[1]);
+    if(!in)
+        fprintf(stderr, "pinyingen: can't read %s, writing an empty table\n", argv[1]);
+    std::string line;
+    size_t readings = 0;
+    while(std::getline(in, line)) {
+        // U+4E2D<tab>kMandarin<tab>zhōng [more readings]
+        if(line.compare(0, 2, "U+") != 0) continue;
+        size_t tab1 = line.find('\t'), tab2 = line.find('\t', tab1 + 1);
+        if(tab1 == std::string::npos || tab2 == std::string::npos) continue;
+        if(line.compare(tab1 + 1, tab2 - tab1 - 1, "kMandarin") != 0) continue;
+        uint32_t code = strtoul(line.c_str() + 2, NULL, 16);
+        if(code < FIRST || code > LAST) continue;
+
+        // Most common reading comes first
+        std::string reading = line.substr(tab2 + 1);
+        reading = reading.substr(0, reading.find(' '));
+        std::string plain = strip_tones(reading);
+        if(plain.empty()) continue;
+
+        auto it = syllable_index.find(plain);
+        if(it == syllable_index.end()) {
+            it = syllable_index.emplace(plain, (uint16_t)syllables.size()).first;
+            syllables.push_back(plain);
+        }
+        table[code - FIRST] = it->second;
+        ++readings;
+    }
+
+    FILE* out = fopen(argv[2], "w");
+    if(out == NULL) {
+        perror("pinyingen");
+        return 1;
+    }
+    fprintf(out, "// Generated by tools/pinyingen.cpp from %s, do not edit\n", argv[1]);
+    fprintf(out, "// %zu characters, %zu syllables\n", readings, syllables.size() - 1);
+    fprintf(out, "constexpr bool PINYIN_BAKED = %s;\n", readings > 0 ? "true" : "false");
+    fprintf(out, "constexpr uint32_t PINYIN_FIRST = 0x%x, PINYIN_LAST = 0x%x;\n", FIRST, LAST);
+    fprintf(out, "constexpr const char* PINYIN_SYLLABLES[%zu] = {", syllables.size());
+    for(size_t i = 0; i < syllables.size(); ++i)
+        fprintf(out, "%s\"%s\",", i % 12 == 0 ? "\n    " : " ", syllables[i].c_str());
+    fprintf(out, "\n};\n");
+    fprintf(out, "constexpr uint16_t PINYIN_HAN[%u] = {", LAST - FIRST + 1);
+    for(size_t i = 0; i < table.size(); ++i)
+        fprintf(out, "%s%u,", i % 24 == 0 ? "\n    " : "", table[i]);
+    fprintf(out, "\n};\n");
+    fclose(out);
+    return 0;
+}
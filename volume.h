@@ -0,0 +1,138 @@
+#pragma once
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Storage the firmware indexes, and how its paths appear in the db. The first
+// volume is the primary one: its directories are listed by their plain name,
+// directories on the others get the volume name in front ("sd_1/Music").
+struct Volume {
+    std::string name;  // "sd_0"
+    std::string mount; // "/mnt/sd_0/"
+    std::string drive; // db path prefix, "a:\"
+    dev_t device = 0;  // Whole disk holding it, partitions share their disk's
+
+    // Appends the db path of a file under the mount point, "a:\dir\file"
+    template<typename Str>
+    void db_path(const std::string& path, Str& out) const {
+        size_t start = out.size();
+        out.append(drive.data(), drive.size());
+        out.append(path.data() + mount.size(), path.size() - mount.size());
+        for(size_t i = start; i < out.size(); ++i)
+            if(out[i] == '/') out[i] = '\\';
+    }
+};
+
+// Only the first card's "a:" is confirmed. What the firmware calls the second
+// card in its db isn't known, so it's left out until a line like "sd_1 b:\"
+// in the drives file says.
+constexpr struct { const char* name; const char* mount; const char* drive; } KNOWN_VOLUMES[] = {
+    {"sd_0", "/mnt/sd_0/", "a:\\"},
+    {"sd_1", "/mnt/sd_1/", nullptr},
+};
+
+class Volumes {
+    std::string drives_path_;
+    std::vector<Volume> list_;
+    bool primary_ = false; // list_[0] is KNOWN_VOLUMES[0]
+
+    // Disk a partition belongs to, from sysfs, so two partitions of one card
+    // share a worker
+    static dev_t disk_of(dev_t device) {
+        char path[96];
+        snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/partition", major(device), minor(device));
+        struct stat st;
+        if(stat(path, &st) != 0) return device;
+        snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/../dev", major(device), minor(device));
+        unsigned maj, min;
+        FILE* file = fopen(path, "r");
+        if(file == NULL) return device;
+        bool ok = fscanf(file, "%u:%u", &maj, &min) == 2;
+        fclose(file);
+        return ok ? makedev(maj, min) : device;
+    }
+
+    // Drive prefix for a volume name from the drives file, else the known one
+    std::string drive_of(size_t known) const {
+        std::ifstream file(drives_path_);
+        std::string name, drive;
+        while(file >> name >> drive) {
+            if(name != KNOWN_VOLUMES[known].name) continue;
+            if(drive.back() != '\\') drive += '\\';
+            return drive;
+        }
+        return KNOWN_VOLUMES[known].drive != nullptr ? KNOWN_VOLUMES[known].drive : "";
+    }
+
+public:
+    explicit Volumes(std::string drives_path = "/data/tagadder.drives") : drives_path_(std::move(drives_path)) {}
+
+    // Finds which of the known mount points have something mounted. One whose
+    // db prefix isn't known is skipped, its paths would be written wrong.
+    void load() {
+        list_.clear();
+        primary_ = false;
+        for(size_t i = 0; i < sizeof(KNOWN_VOLUMES) / sizeof(KNOWN_VOLUMES[0]); ++i) {
+            struct stat mount, parent;
+            std::string dir = KNOWN_VOLUMES[i].mount;
+            if(stat(dir.c_str(), &mount) != 0 || stat((dir + "..").c_str(), &parent) != 0) continue;
+            // A mount point is on a different device than its parent
+            if(mount.st_dev == parent.st_dev) continue;
+            Volume volume;
+            volume.name = KNOWN_VOLUMES[i].name;
+            volume.mount = dir;
+            volume.drive = drive_of(i);
+            if(volume.drive.empty()) {
+                std::cout << "Volume " << volume.name << " is mounted but its db drive isn't known, not using it"
+                    << " (add \"" << volume.name << " <drive>:\\\" to " << drives_path_ << ")\n";
+                continue;
+            }
+            volume.device = disk_of(mount.st_dev);
+            std::cout << "Volume " << volume.name << " (" << major(volume.device) << ":" << minor(volume.device)
+                << ") as " << volume.drive << "\n";
+            if(i == 0) primary_ = true;
+            list_.push_back(std::move(volume));
+        }
+    }
+
+    const std::vector<Volume>& all() const { return list_; }
+
+    // Distinct disks, one importer each
+    std::vector<dev_t> devices() const {
+        std::vector<dev_t> devices;
+        for(auto& volume : list_) {
+            bool seen = false;
+            for(dev_t device : devices) seen = seen || device == volume.device;
+            if(!seen) devices.push_back(volume.device);
+        }
+        return devices;
+    }
+
+    // Name a directory is listed (and queued, and journalled) under
+    std::string display(const Volume& volume, const std::string& relative) const {
+        if(primary_ && &volume == &list_[0]) return relative;
+        return volume.name + "/" + relative;
+    }
+
+    // Volume a listed directory is on and its path below the mount point,
+    // nullptr if that volume isn't mounted
+    const Volume* resolve(const std::string& directory, std::string& relative) const {
+        for(size_t i = primary_ ? 1 : 0; i < list_.size(); ++i) {
+            const std::string& name = list_[i].name;
+            if(directory.size() > name.size() && directory.compare(0, name.size(), name) == 0 && directory[name.size()] == '/') {
+                relative = directory.substr(name.size() + 1);
+                return &list_[i];
+            }
+        }
+        if(!primary_) return nullptr;
+        relative = directory;
+        return &list_[0];
+    }
+};
@@ -0,0 +1,28 @@
+#pragma once
+#include <mutex>
+#include <condition_variable>
+
+// Lets a thread sleep until another one reports a change. Notifications
+// coalesce: a waiter only learns that something changed since it last looked.
+class Wakeup {
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    unsigned long generation_ = 0;
+
+public:
+    void notify() {
+        {
+            std::lock_guard<decltype(mutex_)> lock(mutex_);
+            ++generation_;
+        }
+        condition_.notify_all();
+    }
+
+    // Blocks until the generation differs from seen, returns the new one
+    unsigned long wait(unsigned long seen) {
+        std::unique_lock<decltype(mutex_)> lock(mutex_);
+        while(generation_ == seen) // Handle spurious wake-ups.
+            condition_.wait(lock);
+        return generation_;
+    }
+};
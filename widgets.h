@@ -0,0 +1,240 @@
+#pragma once
+#include <stdint.h>
+#include <algorithm>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Retained widget model: the render thread describes each screen as a list of
+// widgets, and only the regions whose widgets changed get repainted + flushed.
+
+struct Rect {
+    int32_t x = 0, y = 0, w = 0, h = 0;
+
+    bool empty() const { return w <= 0 || h <= 0; }
+    int32_t right() const { return x + w; }
+    int32_t bottom() const { return y + h; }
+
+    bool intersects(const Rect& o) const {
+        return !empty() && !o.empty() &&
+            x < o.right() && o.x < right() && y < o.bottom() && o.y < bottom();
+    }
+
+    // Overlapping or touching edges
+    bool adjacent(const Rect& o) const {
+        return x <= o.right() && o.x <= right() && y <= o.bottom() && o.y <= bottom();
+    }
+
+    Rect intersected(const Rect& o) const {
+        int32_t x0 = std::max(x, o.x), y0 = std::max(y, o.y);
+        int32_t x1 = std::min(right(), o.right()), y1 = std::min(bottom(), o.bottom());
+        if(x1 <= x0 || y1 <= y0) return Rect{};
+        return Rect{x0, y0, x1 - x0, y1 - y0};
+    }
+
+    Rect united(const Rect& o) const {
+        if(empty()) return o;
+        if(o.empty()) return *this;
+        int32_t x0 = std::min(x, o.x), y0 = std::min(y, o.y);
+        int32_t x1 = std::max(right(), o.right()), y1 = std::max(bottom(), o.bottom());
+        return Rect{x0, y0, x1 - x0, y1 - y0};
+    }
+
+    bool operator==(const Rect& o) const { return x == o.x && y == o.y && w == o.w && h == o.h; }
+    bool operator!=(const Rect& o) const { return !(*this == o); }
+};
+
+// Set of screen areas that need flushing; touching areas are merged
+class DirtyRegions {
+    // Past this many separate rects a single bounding flush is cheaper
+    static constexpr size_t MAX_RECTS = 8;
+    std::vector<Rect> rects_;
+
+public:
+    void add(Rect r) {
+        if(r.empty()) return;
+        // Keep merging until r does not touch anything left in the list
+        for(size_t i = 0; i < rects_.size();) {
+            if(rects_[i].adjacent(r)) {
+                r = r.united(rects_[i]);
+                rects_.erase(rects_.begin() + i);
+                i = 0;
+            } else
+                ++i;
+        }
+        rects_.push_back(r);
+        if(rects_.size() > MAX_RECTS) {
+            Rect all{};
+            for(auto& d : rects_) all = all.united(d);
+            rects_.assign(1, all);
+        }
+    }
+
+    bool empty() const { return rects_.empty(); }
+    const std::vector<Rect>& rects() const { return rects_; }
+    void clear() { rects_.clear(); }
+};
+
+struct Widget {
+    enum class Kind : uint8_t { Fill, Frame, Text, List };
+
+    Kind kind = Kind::Fill;
+    Rect bounds{};
+    uint32_t fg = 0, bg = 0;
+    // Text only: pen position (baseline) and font size
+    int32_t text_x = 0, text_y = 0;
+    uint32_t size = 0;
+    std::string text{};
+    // List only: scroll offset in pixels and version of the rows shown
+    int32_t scroll = 0;
+    uint32_t version = 0;
+
+    static Widget fill(Rect r, uint32_t color) {
+        Widget wd; wd.kind = Kind::Fill; wd.bounds = r; wd.fg = wd.bg = color;
+        return wd;
+    }
+
+    static Widget frame(Rect r, uint32_t color) {
+        Widget wd; wd.kind = Kind::Frame; wd.bounds = r; wd.fg = color;
+        return wd;
+    }
+
+    // Text drawn with its baseline at (x, y), cut off at `right`. The bounds
+    // cover the full line height so a shorter replacement erases the old text.
+    static Widget label(int32_t x, int32_t y, int32_t right, uint32_t size,
+            std::string text, uint32_t fg, uint32_t bg) {
+        Widget wd; wd.kind = Kind::Text;
+        wd.bounds = Rect{x, y - (int32_t)size, right - x, (int32_t)(size + size / 3 + 1)};
+        wd.fg = fg; wd.bg = bg;
+        wd.text_x = x; wd.text_y = y; wd.size = size;
+        wd.text = std::move(text);
+        return wd;
+    }
+
+    // Scrolled window onto a list of rows, the painter draws the rows
+    static Widget list(Rect r, int32_t scroll, uint32_t version) {
+        Widget wd; wd.kind = Kind::List; wd.bounds = r;
+        wd.scroll = scroll; wd.version = version;
+        return wd;
+    }
+
+    bool operator==(const Widget& o) const {
+        return kind == o.kind && bounds == o.bounds && fg == o.fg && bg == o.bg &&
+            text_x == o.text_x && text_y == o.text_y && size == o.size && text == o.text &&
+            scroll == o.scroll && version == o.version;
+    }
+    bool operator!=(const Widget& o) const { return !(*this == o); }
+};
+
+// Holds the widgets currently on screen and works out what to repaint
+class Scene {
+    std::vector<Widget> retained_;
+    DirtyRegions dirty_;
+    Rect screen_;
+    uint32_t background_;
+    bool first_ = true;
+
+public:
+    Scene(Rect screen, uint32_t background) : screen_(screen), background_(background) {}
+
+    // Force everything to be repainted on the next update
+    void invalidate() { first_ = true; }
+
+    // Swap in the next list of widgets. paint(widget, clip) must draw the widget
+    // without touching pixels outside clip. Returns the areas that need flushing.
+    template<typename Paint>
+    const DirtyRegions& update(std::vector<Widget> next, Paint&& paint) {
+        dirty_.clear();
+        if(first_) {
+            dirty_.add(screen_);
+            first_ = false;
+        } else {
+            size_t common = std::min(retained_.size(), next.size());
+            for(size_t i = 0; i < common; ++i) {
+                if(retained_[i] != next[i]) {
+                    dirty_.add(retained_[i].bounds.intersected(screen_));
+                    dirty_.add(next[i].bounds.intersected(screen_));
+                }
+            }
+            for(size_t i = common; i < retained_.size(); ++i)
+                dirty_.add(retained_[i].bounds.intersected(screen_));
+            for(size_t i = common; i < next.size(); ++i)
+                dirty_.add(next[i].bounds.intersected(screen_));
+        }
+
+        // Clear each dirty area and redraw whatever overlaps it, in order
+        for(auto& clip : dirty_.rects()) {
+            paint(Widget::fill(clip, background_), clip);
+            for(auto& wd : next) {
+                if(wd.bounds.intersects(clip))
+                    paint(wd, wd.bounds.intersected(clip));
+            }
+        }
+
+        retained_ = std::move(next);
+        return dirty_;
+    }
+};
+
+// One list row rendered to an alpha bitmap
+struct RowBitmap {
+    int32_t w = 0, h = 0;
+    int32_t baseline = 0; // from the top
+    std::vector<uint8_t> alpha{}; // w * h
+
+    size_t bytes() const { return alpha.size() + sizeof(RowBitmap); }
+};
+
+// Least recently used rendered rows, bounded in bytes
+class RowCache {
+    typedef std::pair<size_t, RowBitmap> Entry;
+    std::list<Entry> lru_; // most recent first
+    std::unordered_map<size_t, std::list<Entry>::iterator> index_;
+    size_t bytes_ = 0, budget_;
+    uint32_t version_ = 0;
+
+    void trim() {
+        // Always keep the row just added
+        while(bytes_ > budget_ && lru_.size() > 1) {
+            bytes_ -= lru_.back().second.bytes();
+            index_.erase(lru_.back().first);
+            lru_.pop_back();
+        }
+    }
+
+public:
+    explicit RowCache(size_t budget) : budget_(budget) {}
+
+    // Rows belong to one version of the list, anything else is dropped
+    void set_version(uint32_t version) {
+        if(version == version_) return;
+        version_ = version;
+        lru_.clear();
+        index_.clear();
+        bytes_ = 0;
+    }
+
+    void set_budget(size_t budget) {
+        budget_ = budget;
+        trim();
+    }
+
+    size_t bytes() const { return bytes_; }
+
+    // Cached row, or render(row) is called to make it
+    template<typename Render>
+    const RowBitmap& get(size_t row, Render&& render) {
+        auto it = index_.find(row);
+        if(it != index_.end()) {
+            lru_.splice(lru_.begin(), lru_, it->second);
+            return it->second->second;
+        }
+        lru_.emplace_front(row, render(row));
+        index_[row] = lru_.begin();
+        bytes_ += lru_.front().second.bytes();
+        trim();
+        return lru_.front().second;
+    }
+};